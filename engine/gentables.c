@@ -0,0 +1,106 @@
+/********************************************
+ *             ATTACK TABLE GENERATOR       *
+ ********************************************/
+/*
+ * Builds the leaper, slider and between tables the same way init_all()
+ * does at runtime and prints them as const arrays. The engine built with
+ * -DPREGENERATED_TABLES includes the output as attack_tables.h, so the
+ * tables live in read-only data shared by every engine process.
+ *
+ * make tables (./gentables > attack_tables.h)
+ */
+#define NO_ENGINE_MAIN
+#define BOTH_SLIDER_LAYOUTS
+#include "main.c"
+
+// print count bitboards as a comma separated initializer body
+void printBitboards(const U64 *bitboards, int count, const char *indent) {
+    for (int index = 0; index < count; index++)
+    {
+        if (index % 4 == 0)
+            printf("%s", indent);
+
+        printf("0x%016llxULL,", bitboards[index]);
+        printf((index % 4 == 3 || index == count - 1) ? "\n" : " ");
+    }
+}
+
+// slider table of each backend, [sliderMagic] then [sliderPext]
+const char *slider_table_names[] = {"sliderMagicAttacks", "sliderPextAttacks"};
+const int slider_table_sizes[] = {magic_table_size, pext_table_size};
+
+// print the magic entries of one backend, pointing into its slider table
+void printMagicEntries(const magic_entry *entries, int backend) {
+    printf("    {\n");
+
+    for (int square = 0; square < 64; square++)
+        printf("        {%s + %d, 0x%016llxULL, 0x%016llxULL, %d},\n",
+               slider_table_names[backend], (int) (entries[square].attacks - sliderAttacks),
+               entries[square].mask, entries[square].magic, entries[square].shift);
+
+    printf("    },\n");
+}
+
+int main(void) {
+    initLeaperAttacks();
+    initSquaresBetween();
+
+    printf("// generated by gentables, do not edit\n\n");
+
+    printf("const U64 pawnAttacks[2][64] = {\n");
+    for (int color = white; color <= black; color++)
+    {
+        printf("    {\n");
+        printBitboards(pawnAttacks[color], 64, "        ");
+        printf("    },\n");
+    }
+    printf("};\n\n");
+
+    printf("const U64 knightAttacks[64] = {\n");
+    printBitboards(knightAttacks, 64, "    ");
+    printf("};\n\n");
+
+    printf("const U64 kingAttacks[64] = {\n");
+    printBitboards(kingAttacks, 64, "    ");
+    printf("};\n\n");
+
+    printf("const U64 squaresBetween[64][64] = {\n");
+    for (int square = 0; square < 64; square++)
+    {
+        printf("    {\n");
+        printBitboards(squaresBetween[square], 64, "        ");
+        printf("    },\n");
+    }
+    printf("};\n\n");
+
+    // one slider table per backend, each only as large as its own layout
+    static magic_entry bishopEntries[2][64];
+    static magic_entry rookEntries[2][64];
+
+    for (int backend = sliderMagic; backend <= sliderPext; backend++)
+    {
+        // pext ordering is built without the instruction, so any host can generate it
+        sliderBackend = backend;
+        initSliderAttacks(bishop);
+        initSliderAttacks(rook);
+
+        memcpy(bishopEntries[backend], bishopMagicEntries, sizeof(bishopMagicEntries));
+        memcpy(rookEntries[backend], rookMagicEntries, sizeof(rookMagicEntries));
+
+        printf("const U64 %s[%d] = {\n", slider_table_names[backend], slider_table_sizes[backend]);
+        printBitboards(sliderAttacks, slider_table_sizes[backend], "    ");
+        printf("};\n\n");
+    }
+
+    printf("const magic_entry bishopMagicEntries[2][64] = {\n");
+    for (int backend = sliderMagic; backend <= sliderPext; backend++)
+        printMagicEntries(bishopEntries[backend], backend);
+    printf("};\n\n");
+
+    printf("const magic_entry rookMagicEntries[2][64] = {\n");
+    for (int backend = sliderMagic; backend <= sliderPext; backend++)
+        printMagicEntries(rookEntries[backend], backend);
+    printf("};\n");
+
+    return 0;
+}
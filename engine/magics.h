@@ -0,0 +1,96 @@
+// generated by magicsearch, do not edit
+#ifndef MAGICS_H
+#define MAGICS_H
+
+// shared magic slider table size in entries
+#define magic_table_size 107205
+
+// rook magic numbers
+const U64 rook_magic_numbers[64] = {
+    0x80008020400011ULL, 0x1140200040001000ULL, 0x4200200880401200ULL, 0x100100009002004ULL,
+    0x4100040290080100ULL, 0x80040080020001ULL, 0x1002200258c2300ULL, 0x8010430004a180ULL,
+    0x210c8001c00c806eULL, 0x8002004200210080ULL, 0x810801000200084ULL, 0x8020020100a0040ULL,
+    0x1041800800801400ULL, 0x1002000804020010ULL, 0xe62c00052410080eULL, 0x8018800100004080ULL,
+    0x40008000402080ULL, 0x910014000200040ULL, 0x811010010402000ULL, 0x828090020100100ULL,
+    0x10050011018800ULL, 0x9040808004000200ULL, 0x2a40002481011ULL, 0x45a86a0001028554ULL,
+    0x20400080208000ULL, 0x8000200080804000ULL, 0x1462100480200084ULL, 0x2002090100221000ULL,
+    0x480d000d00380010ULL, 0x800020080040080ULL, 0x80062140010c108ULL, 0x4801060012815cULL,
+    0x408400422801080ULL, 0x402002401000ULL, 0x10012000c5001501ULL, 0x5000a0022001040ULL,
+    0x2300800800800400ULL, 0xb07002a09001400ULL, 0x5800080104000210ULL, 0x8a00014502001984ULL,
+    0x8400890218001ULL, 0x201000414000ULL, 0x810040028002000ULL, 0x2100100090020ULL,
+    0x110080005010010ULL, 0x802020004008080ULL, 0xc20001081a0c0010ULL, 0x3084e39144020005ULL,
+    0x1080002000400040ULL, 0x804000804d002900ULL, 0x8150610c1a00100ULL, 0x1000800800100080ULL,
+    0x4843001008000500ULL, 0x800400120180ULL, 0x20308128020400ULL, 0xa0d040081004200ULL,
+    0x5425102080030145ULL, 0x4040804001002011ULL, 0x9888012000e321aULL, 0x2202402200244aaaULL,
+    0x1cc480015050031ULL, 0x1000400020803ULL, 0x6242100248170884ULL, 0x4c030000c08a0721ULL,
+};
+
+// bishop magic numbers
+const U64 bishop_magic_numbers[64] = {
+    0xb8f95273fa4977ffULL, 0x689609593447fcc3ULL, 0x21418300a0610661ULL, 0xf533c30bb161460aULL,
+    0x5804042000000180ULL, 0x40c0a254a7a9a1f0ULL, 0x79109cd0167ff874ULL, 0x4ff9d62e260bfffaULL,
+    0x359e0e0ccbb2effdULL, 0x4df92192656273feULL, 0x25200895d0e08260ULL, 0xc84973c30bb273beULL,
+    0x1114848408842b2ULL, 0x7d1bf0a253a99489ULL, 0xb19a25329164ffb2ULL, 0xcc0229b9b283ffafULL,
+    0xe9c0834ab39aafcbULL, 0xc46014a549e56fdfULL, 0x2004040810900ULL, 0x22140bc8012021a4ULL,
+    0x94000084a02400ULL, 0x680281a50060c096ULL, 0x52440250acfb3febULL, 0x1c34028a26510ULL,
+    0x378b5b840989effcULL, 0x78347914cbb2c9feULL, 0x802010008004401ULL, 0x8007040020440080ULL,
+    0x8901004064004040ULL, 0x3282000b080208ULL, 0xff3b509b6e8a75c7ULL, 0x701753aac34b9c0ULL,
+    0xe6b8e006eb4ef2d1ULL, 0x8404a8c302283000ULL, 0x1024040100088200ULL, 0x1001080800220a01ULL,
+    0x2308102400014100ULL, 0x1908100100402082ULL, 0xc88c4ac60540200ULL, 0xc886c5028050101ULL,
+    0x619284c309083848ULL, 0x2128a30303481c80ULL, 0x84c8820802014105ULL, 0x804200201803ef00ULL,
+    0x20401881200a00ULL, 0x8008104080202600ULL, 0x99bfeab4d4c4ec02ULL, 0xac22718068d61dc6ULL,
+    0xe1dfecdac642699fULL, 0xe3ebfb77966936ffULL, 0x4a030c0c1418004ULL, 0x902000420a80300ULL,
+    0xf1d36c4fa8bcb589ULL, 0x76cd8b064d70dceaULL, 0x777ed509d81ca8b1ULL, 0xc87f69c692df5ad3ULL,
+    0xf247fd7bb6e89581ULL, 0xf84497fe7d52ad54ULL, 0x4112054c0c14180ULL, 0x21e008110208807ULL,
+    0x42b2dcfc4fa8bcb5ULL, 0x276bf607446651c1ULL, 0x84847fe6d444d6a4ULL, 0x81ffd9ad94b1fe00ULL,
+};
+
+// rook index bits, shift is 64 - bits
+const int rook_magic_bits[64] = {
+    12, 11, 11, 11, 11, 11, 11, 12,
+    11, 10, 10, 10, 10, 10, 10, 11,
+    11, 10, 10, 10, 10, 10, 10, 11,
+    11, 10, 10, 10, 10, 10, 10, 11,
+    11, 10, 10, 10, 10, 10, 10, 11,
+    11, 10, 10, 10, 10, 10, 10, 11,
+    11, 10, 10, 10, 10, 10, 10, 11,
+    12, 11, 11, 11, 11, 11, 11, 12,
+};
+
+// bishop index bits, shift is 64 - bits
+const int bishop_magic_bits[64] = {
+    5, 4, 5, 5, 5, 5, 4, 5,
+    4, 4, 5, 5, 5, 5, 4, 4,
+    4, 4, 7, 7, 7, 7, 4, 5,
+    5, 5, 7, 9, 9, 7, 5, 5,
+    5, 5, 7, 9, 9, 7, 5, 5,
+    5, 5, 7, 7, 7, 7, 4, 5,
+    4, 4, 5, 5, 5, 5, 4, 4,
+    5, 4, 5, 5, 5, 5, 4, 5,
+};
+
+// rook slice offsets in the shared table
+const int rook_magic_offsets[64] = {
+    0, 16384, 18432, 20480, 22528, 24576, 26624, 4096,
+    28672, 65533, 66557, 67581, 68605, 69629, 70653, 30720,
+    32768, 71677, 72701, 73725, 74749, 75773, 76797, 34816,
+    36864, 77821, 78845, 79869, 80893, 81917, 82941, 38912,
+    40960, 83965, 84989, 86013, 87037, 88061, 89085, 43008,
+    45056, 90109, 91133, 92157, 93181, 94205, 95229, 47104,
+    49152, 96253, 97277, 98301, 99325, 100349, 101373, 51200,
+    8192, 53248, 63487, 61440, 55296, 57344, 59392, 12288,
+};
+
+// bishop slice offsets in the shared table
+const int bishop_magic_offsets[64] = {
+    105981, 106949, 106485, 106237, 106013, 106723, 106965, 106045,
+    106981, 106997, 106513, 106268, 106077, 106752, 107013, 107029,
+    107045, 107061, 104445, 104573, 104701, 104829, 107077, 106781,
+    106299, 106543, 104957, 102397, 102909, 105085, 106573, 106330,
+    106361, 106392, 105213, 103421, 103933, 105341, 106423, 106454,
+    106809, 106837, 105469, 105597, 105725, 105853, 107093, 106865,
+    107109, 107125, 106603, 106109, 106633, 106893, 107141, 107157,
+    106141, 107173, 106663, 106173, 106693, 106921, 107189, 106205,
+};
+
+#endif
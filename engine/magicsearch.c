@@ -0,0 +1,339 @@
+/********************************************
+ *             MAGIC NUMBER SEARCH          *
+ ********************************************/
+/*
+ * Searches rook and bishop magics for all 128 squares on several threads,
+ * then packs the per square tables into one shared array where slices may
+ * overlap wherever their entries agree. Once a square has a magic, the rest
+ * of its time goes to magics whose highest index is lower, the unused top of
+ * a slice is free for the next one. Every magic is checked against the
+ * on the fly attack generators and the packed table is verified again
+ * before magics.h is printed.
+ *
+ * make magics (./magicsearch [threads] [fewer bits] [seconds per square])
+ */
+#define NO_ENGINE_MAIN
+#include "main.c"
+#include <pthread.h>
+
+// one square of one slider
+typedef struct {
+    int bishop;
+    int square;
+    U64 mask;
+    int maskBits;
+    U64 occupancies[4096];
+    U64 attacks[4096];
+    U64 magic;
+    int bits;
+    int span; // highest index used + 1
+    int offset;
+} magic_job;
+
+// 64 rook jobs followed by 64 bishop jobs
+magic_job jobs[128];
+
+// next job a worker picks up
+int nextJob = 0;
+
+// how many bits below the relevant bit count to try first
+int fewerBits = 1;
+
+// time spent on every reduced bit count before falling back, and again on
+// lowering the highest index of the magic found
+long long msPerSquare = 10000;
+
+// xorshift64 stream, every thread owns one instead of sharing magic.h's seed
+static inline U64 nextRandom(U64 *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+
+    return *state;
+}
+
+// sparse candidates find full size magics quickly, dense ones are the
+// ones that squeeze into fewer bits, so cycle through 1 to 3 ands
+static inline U64 nextCandidate(U64 *state, int density) {
+    U64 candidate = nextRandom(state);
+
+    for (int round = 0; round < density; round++)
+        candidate &= nextRandom(state);
+
+    return candidate;
+}
+
+// look for a magic mapping every occupancy to an index below span with no
+// destructive collision, constructive ones (same attacks) are allowed, 0 on timeout
+U64 searchMagic(const magic_job *job, int bits, int span, U64 *state, long long deadline) {
+    U64 used[4096];
+
+    // epoch per slot spares a memset for every candidate
+    int epochs[4096];
+    memset(epochs, 0, sizeof(epochs));
+
+    for (int attempt = 1; attempt < 0x7fffffff; attempt++)
+    {
+        if ((attempt & 0xfff) == 0 && getTimeMs() > deadline)
+            return 0ULL;
+
+        U64 magic = nextCandidate(state, attempt % 3);
+
+        // skip magics that do not spread the mask into the top bits
+        if (countBits((job->mask * magic) & 0xFF00000000000000ULL) < 6)
+            continue;
+
+        int fail = 0;
+
+        for (int index = 0; index < (1 << job->maskBits); index++)
+        {
+            int magicIndex = (int) ((job->occupancies[index] * magic) >> (64 - bits));
+
+            if (magicIndex >= span)
+            {
+                fail = 1;
+                break;
+            }
+
+            if (epochs[magicIndex] != attempt)
+            {
+                epochs[magicIndex] = attempt;
+                used[magicIndex] = job->attacks[index];
+            } else if (used[magicIndex] != job->attacks[index])
+            {
+                fail = 1;
+                break;
+            }
+        }
+
+        if (!fail)
+            return magic;
+    }
+
+    return 0ULL;
+}
+
+// highest index a magic uses + 1
+int magicSpan(const magic_job *job, U64 magic, int bits) {
+    int span = 0;
+
+    for (int index = 0; index < (1 << job->maskBits); index++)
+    {
+        int magicIndex = (int) ((job->occupancies[index] * magic) >> (64 - bits));
+
+        if (magicIndex >= span)
+            span = magicIndex + 1;
+    }
+
+    return span;
+}
+
+void *searchWorker(void *argument) {
+    // distinct stream per thread
+    U64 state = 0x9E3779B97F4A7C15ULL * (U64) ((long) argument + 1);
+
+    int jobIndex;
+
+    while ((jobIndex = __atomic_fetch_add(&nextJob, 1, __ATOMIC_RELAXED)) < 128)
+    {
+        magic_job *job = &jobs[jobIndex];
+
+        // try the reduced bit counts first, the full count always succeeds
+        for (job->bits = job->maskBits - fewerBits; job->bits <= job->maskBits; job->bits++)
+        {
+            long long deadline = (job->bits < job->maskBits) ? getTimeMs() + msPerSquare : 0x7fffffffffffffffLL;
+
+            if ((job->magic = searchMagic(job, job->bits, 1 << job->bits, &state, deadline)))
+                break;
+        }
+
+        job->span = magicSpan(job, job->magic, job->bits);
+
+        // same bits, every further hit lowers the highest index
+        long long deadline = getTimeMs() + msPerSquare;
+        U64 magic;
+
+        while ((magic = searchMagic(job, job->bits, job->span - 1, &state, deadline)))
+        {
+            job->magic = magic;
+            job->span = magicSpan(job, magic, job->bits);
+        }
+
+        fprintf(stderr, "%s %s: %d bits (relevant %d), %d of %d slots\n", job->bishop ? "bishop" : "rook",
+                square_to_coordinate[job->square], job->bits, job->maskBits, job->span, 1 << job->bits);
+    }
+
+    return NULL;
+}
+
+// fill one job's slice, 0 marks slots no occupancy maps to
+void buildSlice(const magic_job *job, U64 *slice) {
+    memset(slice, 0, sizeof(U64) * (1 << job->bits));
+
+    for (int index = 0; index < (1 << job->maskBits); index++)
+        slice[(job->occupancies[index] * job->magic) >> (64 - job->bits)] = job->attacks[index];
+}
+
+// first fit packing, largest slices first, slider attacks are never empty so
+// 0 in the table is free and a slot already holding the same attacks is shared
+int packTables(U64 *table) {
+    static U64 slice[4096];
+    int order[128];
+    int tableSize = 0;
+
+    for (int jobIndex = 0; jobIndex < 128; jobIndex++)
+        order[jobIndex] = jobIndex;
+
+    // insertion sort by slice size, descending
+    for (int i = 1; i < 128; i++)
+        for (int j = i; j > 0 && jobs[order[j]].span > jobs[order[j - 1]].span; j--)
+        {
+            int swap = order[j];
+            order[j] = order[j - 1];
+            order[j - 1] = swap;
+        }
+
+    for (int i = 0; i < 128; i++)
+    {
+        magic_job *job = &jobs[order[i]];
+        int size = job->span;
+
+        buildSlice(job, slice);
+
+        for (int offset = 0;; offset++)
+        {
+            int fits = 1;
+
+            for (int index = 0; fits && index < size; index++)
+                if (slice[index] && table[offset + index] && table[offset + index] != slice[index])
+                    fits = 0;
+
+            if (!fits)
+                continue;
+
+            for (int index = 0; index < size; index++)
+                if (slice[index])
+                    table[offset + index] = slice[index];
+
+            job->offset = offset;
+
+            if (offset + size > tableSize)
+                tableSize = offset + size;
+
+            break;
+        }
+    }
+
+    return tableSize;
+}
+
+// recompute every occupancy through the packed table
+int verifyTables(const U64 *table) {
+    for (int jobIndex = 0; jobIndex < 128; jobIndex++)
+    {
+        const magic_job *job = &jobs[jobIndex];
+
+        for (int index = 0; index < (1 << job->maskBits); index++)
+        {
+            U64 occupancy = setOccupancy(index, job->maskBits, job->mask);
+            U64 attacks = job->bishop
+                              ? getBishopAttacksOnTheFly(job->square, occupancy)
+                              : getRookAttacksOnTheFly(job->square, occupancy);
+
+            if (table[job->offset + ((occupancy * job->magic) >> (64 - job->bits))] != attacks)
+                return 0;
+        }
+    }
+
+    return 1;
+}
+
+void printArray(const char *comment, const char *declaration, int bishop, int field) {
+    printf("// %s\n%s = {\n", comment, declaration);
+
+    for (int square = 0; square < 64; square++)
+    {
+        const magic_job *job = &jobs[bishop * 64 + square];
+
+        if (square % (field ? 8 : 4) == 0)
+            printf("    ");
+
+        if (field == 0)
+            printf("0x%llxULL,", job->magic);
+        else
+            printf("%d,", field == 1 ? job->bits : job->offset);
+
+        printf((square % (field ? 8 : 4) == (field ? 7 : 3)) ? "\n" : " ");
+    }
+
+    printf("};\n\n");
+}
+
+int main(int argc, char **argv) {
+    int threadCount = (argc > 1) ? atoi(argv[1]) : 4;
+
+    if (argc > 2)
+        fewerBits = atoi(argv[2]);
+
+    if (argc > 3)
+        msPerSquare = atoll(argv[3]) * 1000;
+
+    if (threadCount < 1)
+        threadCount = 1;
+
+    for (int jobIndex = 0; jobIndex < 128; jobIndex++)
+    {
+        magic_job *job = &jobs[jobIndex];
+
+        job->bishop = jobIndex >= 64;
+        job->square = jobIndex % 64;
+        job->mask = job->bishop ? maskBishopAttacks(job->square) : maskRookAttacks(job->square);
+        job->maskBits = countBits(job->mask);
+
+        for (int index = 0; index < (1 << job->maskBits); index++)
+        {
+            job->occupancies[index] = setOccupancy(index, job->maskBits, job->mask);
+            job->attacks[index] = job->bishop
+                                      ? getBishopAttacksOnTheFly(job->square, job->occupancies[index])
+                                      : getRookAttacksOnTheFly(job->square, job->occupancies[index]);
+        }
+    }
+
+    long long start = getTimeMs();
+
+    pthread_t threads[256];
+    threadCount = threadCount > 256 ? 256 : threadCount;
+
+    for (long thread = 0; thread < threadCount; thread++)
+        pthread_create(&threads[thread], NULL, searchWorker, (void *) thread);
+
+    for (int thread = 0; thread < threadCount; thread++)
+        pthread_join(threads[thread], NULL);
+
+    static U64 table[pext_table_size];
+    int tableSize = packTables(table);
+
+    if (!verifyTables(table))
+    {
+        fprintf(stderr, "verification failed\n");
+        return 1;
+    }
+
+    fprintf(stderr, "%d entries (%d KB) instead of %d, %lld ms on %d threads\n",
+            tableSize, tableSize * 8 / 1024, pext_table_size, getTimeMs() - start, threadCount);
+
+    printf("// generated by magicsearch, do not edit\n");
+    printf("#ifndef MAGICS_H\n#define MAGICS_H\n\n");
+    printf("// shared magic slider table size in entries\n#define magic_table_size %d\n\n", tableSize);
+
+    printArray("rook magic numbers", "const U64 rook_magic_numbers[64]", 0, 0);
+    printArray("bishop magic numbers", "const U64 bishop_magic_numbers[64]", 1, 0);
+    printArray("rook index bits, shift is 64 - bits", "const int rook_magic_bits[64]", 0, 1);
+    printArray("bishop index bits, shift is 64 - bits", "const int bishop_magic_bits[64]", 1, 1);
+    printArray("rook slice offsets in the shared table", "const int rook_magic_offsets[64]", 0, 2);
+    printArray("bishop slice offsets in the shared table", "const int bishop_magic_offsets[64]", 1, 2);
+
+    printf("#endif\n");
+
+    return 0;
+}
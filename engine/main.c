@@ -1,9 +1,59 @@
 // Headers
 #include "magic.h"
 #include "utils.h"
+#include "magics.h"
 #include <string.h>
-#include <windows.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/select.h>
+#endif
+
+// per_thread storage is private to every search thread,
+// atomic_fetch_increment hands out work items between threads
+#ifdef _MSC_VER
+#define per_thread __declspec(thread)
+#define atomic_fetch_increment(counter) (InterlockedIncrement((volatile long *) (counter)) - 1)
+#else
+#define per_thread __thread
+#define atomic_fetch_increment(counter) __atomic_fetch_add((counter), 1, __ATOMIC_RELAXED)
+#endif
+
+// thread start and join
+#ifdef _WIN32
+typedef HANDLE thread_handle;
+#define thread_create(handle, function, argument) \
+    (*(handle) = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE) (function), (argument), 0, NULL))
+#define thread_join(handle) (WaitForSingleObject((handle), INFINITE), CloseHandle(handle))
+#else
+typedef pthread_t thread_handle;
+#define thread_create(handle, function, argument) pthread_create((handle), NULL, (function), (argument))
+#define thread_join(handle) pthread_join((handle), NULL)
+#endif
+
+// logical processors, the default worker count of the perft suite
+static inline int cpuCount() {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int) info.dwNumberOfProcessors;
+#else
+    return (int) sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+}
+
+// most search threads the Threads option allows
+#define max_threads 64
+
+// threads used by go and go perft, set by the Threads option
+int threadCount = 1;
+
 // define bitboard data type
 #define U64 unsigned long long
 
@@ -164,29 +214,35 @@ const U64 not_hg_file = 4557430888798830399ULL; // not hg file constant - all ze
 
 const U64 not_ab_file = 18229723555195321596ULL; // not ab file constant - all zeros on AB file
 
-//  Relevant occupancy bit count for every square on board
-//  How many squares are attacked by a piece standing on the square
-const int bishop_relevant_bits[64] = {
-    6, 5, 5, 5, 5, 5, 5, 6,
-    5, 5, 5, 5, 5, 5, 5, 5,
-    5, 5, 7, 7, 7, 7, 5, 5,
-    5, 5, 7, 9, 9, 7, 5, 5,
-    5, 5, 7, 9, 9, 7, 5, 5,
-    5, 5, 7, 7, 7, 7, 5, 5,
-    5, 5, 5, 5, 5, 5, 5, 5,
-    6, 5, 5, 5, 5, 5, 5, 6
-};
-const int rook_relevant_bits[64] = {
-    12, 11, 11, 11, 11, 11, 11, 12,
-    11, 10, 10, 10, 10, 10, 10, 11,
-    11, 10, 10, 10, 10, 10, 10, 11,
-    11, 10, 10, 10, 10, 10, 10, 11,
-    11, 10, 10, 10, 10, 10, 10, 11,
-    11, 10, 10, 10, 10, 10, 10, 11,
-    11, 10, 10, 10, 10, 10, 10, 11,
-    12, 11, 11, 11, 11, 11, 11, 12
-};
-
+// Per square slider lookup, everything one probe needs sits in 32 bytes
+typedef struct {
+    const U64 *attacks; // start of this square's slice of sliderAttacks
+    U64 mask;     // relevant occupancy mask
+    U64 magic;    // magic multiplier
+    int shift;    // 64 - relevant bits
+} magic_entry;
+
+// Sum of 2^relevant bits over all squares, the size of the pext layout
+#define bishop_table_size 5248
+#define rook_table_size 102400
+#define pext_table_size (bishop_table_size + rook_table_size)
+
+// The runtime table holds whichever layout is active, magic_table_size comes
+// from magics.h, builds without pext only ever need the magic layout unless
+// they generate both (gentables). Only bishop magics get below their relevant
+// bits, so the magic layout is within half a percent of the pext one
+#if defined(PEXT_AVAILABLE) || defined(BOTH_SLIDER_LAYOUTS)
+#define slider_table_size (magic_table_size > pext_table_size ? magic_table_size : pext_table_size)
+#else
+#define slider_table_size magic_table_size
+#endif
+
+#ifdef PREGENERATED_TABLES
+// const leaper, slider and between tables emitted by gentables (make tables),
+// sliderMagicAttacks and sliderPextAttacks each have their own size, the
+// entries come in both orderings [backend]
+#include "attack_tables.h"
+#else
 //  Pawn attack table [side][square]
 U64 pawnAttacks[2][64];
 
@@ -196,17 +252,35 @@ U64 knightAttacks[64];
 //  Knight attack table [side][square]
 U64 kingAttacks[64];
 
-// Bishop attacks mask
-U64 bishopAttackMasks[64];
+// Bishop and rook attacks in one shared array, each square only gets the
+// slots its index bits can address (~840 KB instead of ~2.3 MB), pages the
+// active layout doesn't reach are never touched
+U64 sliderAttacks[slider_table_size];
+
+// Bishop magic entries [square]
+magic_entry bishopMagicEntries[64];
+
+// Rook magic entries [square]
+magic_entry rookMagicEntries[64];
 
-// Rook attacks mask
-U64 rookAttackMasks[64];
+// Squares strictly between two aligned squares [from][to], empty otherwise
+U64 squaresBetween[64][64];
+#endif
+
+// Magic entries of the selected backend [square]
+const magic_entry *bishopMagics;
+const magic_entry *rookMagics;
+
+// slider attack table indexing
+enum {
+    sliderMagic,
+    sliderPext
+};
 
-// Bishop attacks table [square][occupancies]
-U64 bishopAttacks[64][512];
+const char *slider_backend_names[] = {"magic", "pext"};
 
-// Rook attacks table [square][occupancies]
-U64 rookAttacks[64][4096];
+// chosen at startup from CPUID, see initSliderBackend
+int sliderBackend = sliderMagic;
 
 U64 getPawnAttacks(int side, int square) {
     // Piece bitboard
@@ -465,42 +539,70 @@ U64 setOccupancy(int index, int bitsInMask, U64 attackMask) {
     return occupancy;
 }
 
+#ifndef PREGENERATED_TABLES
 // my
 void initSliderAttacks(int bishop) {
-    // Init bishop and rook masks
+    // pext slices are packed back to back with bishops first, magic slices
+    // sit at the offsets magicsearch chose and may overlap each other
+    U64 *pextAttacks = bishop ? sliderAttacks : sliderAttacks + bishop_table_size;
+
     for (int square = 0; square < 64; square++)
     {
-        bishopAttackMasks[square] = maskBishopAttacks(square);
-        rookAttackMasks[square] = maskRookAttacks(square);
+        magic_entry *entry = bishop ? &bishopMagicEntries[square] : &rookMagicEntries[square];
 
         // Init current mask
-        U64 attackMask = bishop ? bishopAttackMasks[square] : rookAttackMasks[square];
+        entry->mask = bishop ? maskBishopAttacks(square) : maskRookAttacks(square);
+        entry->magic = bishop ? bishop_magic_numbers[square] : rook_magic_numbers[square];
+        entry->shift = 64 - (bishop ? bishop_magic_bits[square] : rook_magic_bits[square]);
+
+        U64 *attacks = (sliderBackend == sliderPext)
+                           ? pextAttacks
+                           : sliderAttacks + (bishop ? bishop_magic_offsets[square] : rook_magic_offsets[square]);
+        entry->attacks = attacks;
 
         // Init relevant occupancy bit count
-        int relevantBitCount = countBits(attackMask);
+        int relevantBitCount = countBits(entry->mask);
 
         // Init occupancy indices
         int occupancyIndex = (1 << relevantBitCount);
 
         for (int index = 0; index < occupancyIndex; index++)
         {
-            if (bishop)
-            {
-                // occupancy variation
-                U64 occupancy = setOccupancy(index, relevantBitCount, attackMask);
-                int magicIndex = (occupancy * bishop_magic_numbers[square]) >> (64 - bishop_relevant_bits[square]);
+            // occupancy variation, pext of it gives back index itself
+            U64 occupancy = setOccupancy(index, relevantBitCount, entry->mask);
+            int magicIndex = (sliderBackend == sliderPext)
+                                 ? index
+                                 : (int) ((occupancy * entry->magic) >> entry->shift);
+
+            // init slider attacks
+            attacks[magicIndex] = bishop
+                                             ? getBishopAttacksOnTheFly(square, occupancy)
+                                             : getRookAttacksOnTheFly(square, occupancy);
+        }
 
-                // init bishop attacks
-                bishopAttacks[square][magicIndex] = getBishopAttacksOnTheFly(square, occupancy);
-            } else
-            {
-                // occupancy variation
-                U64 occupancy = setOccupancy(index, relevantBitCount, attackMask);
-                int magicIndex = (occupancy * rook_magic_numbers[square]) >> (64 - rook_relevant_bits[square]);
+        // next square's pext slice starts right after this one
+        pextAttacks += occupancyIndex;
+    }
+}
 
-                // init bishop attacks
-                rookAttacks[square][magicIndex] = getRookAttacksOnTheFly(square, occupancy);
-            }
+void initSquaresBetween() {
+    for (int from = 0; from < 64; from++)
+    {
+        for (int to = 0; to < 64; to++)
+        {
+            squaresBetween[from][to] = 0ULL;
+
+            if (from == to)
+                continue;
+
+            // rays from both ends intersect between the squares if they share a line
+            if (getRookAttacksOnTheFly(from, 0ULL) & (1ULL << to))
+                squaresBetween[from][to] = getRookAttacksOnTheFly(from, 1ULL << to) &
+                                           getRookAttacksOnTheFly(to, 1ULL << from);
+
+            if (getBishopAttacksOnTheFly(from, 0ULL) & (1ULL << to))
+                squaresBetween[from][to] = getBishopAttacksOnTheFly(from, 1ULL << to) &
+                                           getBishopAttacksOnTheFly(to, 1ULL << from);
         }
     }
 }
@@ -515,124 +617,51 @@ void initLeaperAttacks() {
         kingAttacks[square] = getKingAttacks(square);
     }
 }
+#endif
+
+// look up slider attacks through a magic entry
+static inline U64 getSliderAttacks(const magic_entry *entry, U64 occupancy) {
+    // pext gathers the relevant occupancy bits into the index directly
+    if (sliderBackend == sliderPext)
+        return entry->attacks[pext(occupancy, entry->mask)];
+
+    return entry->attacks[((occupancy & entry->mask) * entry->magic) >> entry->shift];
+}
 
 // get bishop attacks
 static inline U64 getBishopAttacks(int square, U64 occupancy) {
-    // get bishop attacks assuming current board occupancy
-    occupancy &= bishopAttackMasks[square];
-    occupancy *= bishop_magic_numbers[square];
-    occupancy >>= 64 - bishop_relevant_bits[square];
-
-    // return bishop attacks
-    return bishopAttacks[square][occupancy];
+    return getSliderAttacks(&bishopMagics[square], occupancy);
 }
 
 // get rook attacks
 static inline U64 getRookAttacks(int square, U64 occupancy) {
-    // get bishop attacks assuming current board occupancy
-    occupancy &= rookAttackMasks[square];
-    occupancy *= rook_magic_numbers[square];
-    occupancy >>= 64 - rook_relevant_bits[square];
-
-    // return rook attacks
-    return rookAttacks[square][occupancy];
+    return getSliderAttacks(&rookMagics[square], occupancy);
 }
 
 static inline U64 getQueenAttacks(int square, U64 occupancy) {
-    // results for combining
-    U64 queenAttacks = 0ULL;
-
-    // bishop occupancies
-    U64 bishopOccupancy = occupancy;
-    U64 rookOccupancy = occupancy;
-
-    // get bishop attacks assuming current board occupancy
-    bishopOccupancy &= bishopAttackMasks[square];
-    bishopOccupancy *= bishop_magic_numbers[square];
-    bishopOccupancy >>= 64 - bishop_relevant_bits[square];
-
-    queenAttacks = bishopAttacks[square][bishopOccupancy];
-
-    // get rook attacks assuming current board occupancy
-    rookOccupancy &= rookAttackMasks[square];
-    rookOccupancy *= rook_magic_numbers[square];
-    rookOccupancy >>= 64 - rook_relevant_bits[square];
-
-    queenAttacks |= rookAttacks[square][rookOccupancy];
-    // return queen attacks
-    return queenAttacks;
+    // queen moves like bishop and rook combined
+    return getBishopAttacks(square, occupancy) | getRookAttacks(square, occupancy);
 }
 
-/********************************************
- *                 MAGIC NUMBERS            *
- ********************************************/
-
-static inline U64 findMagicNumber(int square, int relevantBits, int bishop) {
-    // bishop = true/false
-    // Initialize occupancies
-    U64 occupancies[4096];
-
-    // Initialize attack tables
-    U64 attacks[4096];
-
-    // Initialize used attacks
-    U64 usedAttacks[4096];
-
-    // Initialize attack mask for current piece
-    U64 attackMask = bishop ? maskBishopAttacks(square) : maskRookAttacks(square);
-
-    // Initialize occupancy indices
-    int occupancy_indices = 1 << relevantBits;
-
-    // Loop over occupancy indices
-    for (int index = 0; index < occupancy_indices; ++index)
-    {
-        // Init occupancies
-        occupancies[index] = setOccupancy(index, relevantBits, attackMask);
-        attacks[index] = bishop
-                             ? getBishopAttacksOnTheFly(square, occupancies[index])
-                             : getRookAttacksOnTheFly(square, occupancies[index]);
-    }
-
-    // Test magic numbers loop
-    for (int randomCount = 0; randomCount < 1000000000; randomCount++)
-    {
-        // Generate magic number candidate
-        U64 magicNumber = generateMagicNumberCandidate();
-
-        // skip inappropriate magic numbers
-        if (countBits((attackMask * magicNumber) & 0xFF00000000000000) < 6)
-            continue;
-        memset(usedAttacks, 0ULL, sizeof(usedAttacks));
-
-        // Initialize index and fail flag
-        int index, fail;
-
-        // Test magic index loop
-        for (index = 0, fail = 0; !fail && index < occupancy_indices; index++)
-        {
-            // init magic index
-            int magicIndex = (int) ((occupancies[index] * magicNumber) >> (64 - relevantBits));
-
-            // if magic index works
-            if (usedAttacks[magicIndex] == 0ULL)
-            {
-                // Initialize used attacks
-                usedAttacks[magicIndex] = attacks[index];
-            } else if (usedAttacks[magicIndex] != attacks[index])
-            {
-                // magic index doesnt work
+// pick slider indexing and rebuild the attack tables for it
+void initSliderBackend(int backend) {
+#ifdef PEXT_AVAILABLE
+    sliderBackend = backend;
+#else
+    sliderBackend = sliderMagic;
+#endif
+
+#ifdef PREGENERATED_TABLES
+    // both orderings are baked in, only switch which one is read
+    bishopMagics = bishopMagicEntries[sliderBackend];
+    rookMagics = rookMagicEntries[sliderBackend];
+#else
+    initSliderAttacks(bishop);
+    initSliderAttacks(rook);
 
-                fail = 1;
-                break;
-            }
-        }
-        if (!fail)
-        {
-            return magicNumber;
-        }
-    }
-    return 0ULL;
+    bishopMagics = bishopMagicEntries;
+    rookMagics = rookMagicEntries;
+#endif
 }
 
 /**********************************\
@@ -649,6 +678,7 @@ static inline U64 findMagicNumber(int square, int relevantBits, int bishop) {
  * - 0x200000 ==== 0010 0000 0000 0000 0000 0000 Double push flag
  * - 0x400000 ==== 0100 0000 0000 0000 0000 0000 Enpassant capture
  * - 0x800000 ==== 1000 0000 0000 0000 0000 0000 Castling flag
+ * - 0xf000000 ==== 1111 0000 0000 0000 0000 0000 0000 Captured piece (only valid with the capture flag)
  *
  *
  */
@@ -663,6 +693,8 @@ static inline U64 findMagicNumber(int square, int relevantBits, int bishop) {
 #define move_get_doublepush(move) (move & 0x200000)
 #define move_get_enpassant(move) (move & 0x400000)
 #define move_get_castling(move) (move & 0x800000)
+#define move_get_captured(move) ((move & 0xf000000) >> 24)
+#define move_set_captured(piece) ((piece) << 24)
 
 typedef struct {
     int moves[256];
@@ -757,38 +789,186 @@ const int castling_rights[64] = {
     13, 15, 15, 15, 12, 15, 15, 14
 };
 
-#define copy_board()                           \
-    U64 bitboardsCopy[12], occupanciesCopy[3]; \
-    int sideCopy, enpassantCopy, castleCopy;   \
-    memcpy(bitboardsCopy, bitboards, 96);      \
-    memcpy(occupanciesCopy, occupancies, 24);  \
-    sideCopy = side;                           \
-    enpassantCopy = enpassant;                 \
-    castleCopy = castle;
-#define restore_board()                       \
-    memcpy(bitboards, bitboardsCopy, 96);     \
-    memcpy(occupancies, occupanciesCopy, 24); \
-    side = sideCopy;                          \
-    enpassant = enpassantCopy;                \
-    castle = castleCopy;
+// position state is per thread, every search thread plays moves on its own board
+per_thread U64 bitboards[12];
+
+per_thread U64 occupancies[3];
+
+// empty square in the piece on square array
+#define no_piece 12
+
+// piece on every square (mailbox), kept in sync with the bitboards
+per_thread int pieceOnSquare[64];
+
+per_thread int side = -1;
+
+per_thread int enpassant = no_sq;
+
+per_thread int castle;
+
+// "almost" unique position identifier aka hash key
+per_thread U64 hashKey;
+
+/*
+ * Undo record
+ *
+ * state makeMove can't recover from the move itself,
+ * pushed by makeMove and popped by unmakeMove
+ */
+typedef struct {
+    int capturedPiece;
+    int castle;
+    int enpassant;
+    U64 hashKey;
+} undo_info;
+
+// max half moves played from the root FEN, game moves and search plies together
+#define max_game_ply 2048
+
+// undo stack, indexed by half moves played since the FEN was set up
+per_thread undo_info undoStack[max_game_ply];
+per_thread int undoIndex = 0;
+
+/*
+ * Board state
+ *
+ * copy of a position for handing it to another thread, the undo
+ * stack isn't included, threads only unmake their own moves
+ */
+typedef struct {
+    U64 bitboards[12];
+    U64 occupancies[3];
+    int pieceOnSquare[64];
+    int side;
+    int enpassant;
+    int castle;
+    U64 hashKey;
+} board_state;
+
+// copy the calling thread's board into state
+void saveBoardState(board_state *state) {
+    memcpy(state->bitboards, bitboards, sizeof(bitboards));
+    memcpy(state->occupancies, occupancies, sizeof(occupancies));
+    memcpy(state->pieceOnSquare, pieceOnSquare, sizeof(pieceOnSquare));
+    state->side = side;
+    state->enpassant = enpassant;
+    state->castle = castle;
+    state->hashKey = hashKey;
+}
+
+// set the calling thread's board from state
+void loadBoardState(const board_state *state) {
+    memcpy(bitboards, state->bitboards, sizeof(bitboards));
+    memcpy(occupancies, state->occupancies, sizeof(occupancies));
+    memcpy(pieceOnSquare, state->pieceOnSquare, sizeof(pieceOnSquare));
+    side = state->side;
+    enpassant = state->enpassant;
+    castle = state->castle;
+    hashKey = state->hashKey;
+    undoIndex = 0;
+}
+
+/**********************************
+              ZOBRIST
+    Random keys for every piece on
+    every square, en passant file,
+    castling rights and side
+ **********************************/
+
+// random piece keys [piece][square]
+U64 pieceKeys[12][64];
+
+// random en passant keys [square]
+U64 enpassantKeys[64];
+
+// random castling keys [castling rights]
+U64 castleKeys[16];
 
-U64 bitboards[12];
+// random side key
+U64 sideKey;
+
+// key generator state, splitmix64 instead of the xorshift in magic.h: every
+// xorshift output is a linear function of its 32 bit seed, so xors of those
+// keys only span 2^32 values and distinct positions collide within millions
+U64 keySeed;
+
+static inline U64 getRandomKey() {
+    U64 key = (keySeed += 0x9E3779B97F4A7C15ULL);
+
+    key = (key ^ (key >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    key = (key ^ (key >> 27)) * 0x94D049BB133111EBULL;
+
+    return key ^ (key >> 31);
+}
+
+// init random hash keys
+void initRandomKeys() {
+    // reset seed so keys are identical across runs
+    keySeed = 1804289383;
+
+    for (int piece = P; piece <= k; piece++)
+    {
+        for (int square = 0; square < 64; square++)
+        {
+            pieceKeys[piece][square] = getRandomKey();
+        }
+    }
+
+    for (int square = 0; square < 64; square++)
+    {
+        enpassantKeys[square] = getRandomKey();
+    }
+
+    for (int index = 0; index < 16; index++)
+    {
+        castleKeys[index] = getRandomKey();
+    }
+
+    sideKey = getRandomKey();
+}
+
+// generate hash key of the current position from scratch
+U64 generateHashKey() {
+    U64 finalKey = 0ULL;
+
+    U64 bitboard;
+
+    for (int piece = P; piece <= k; piece++)
+    {
+        bitboard = bitboards[piece];
+
+        while (bitboard)
+        {
+            int square = getLSBIndex(bitboard);
+
+            finalKey ^= pieceKeys[piece][square];
+
+            pop_lsb(bitboard);
+        }
+    }
 
-U64 occupancies[3];
+    if (enpassant != no_sq)
+        finalKey ^= enpassantKeys[enpassant];
 
-int side = -1;
+    finalKey ^= castleKeys[castle];
 
-int enpassant = no_sq;
+    // only hash side when black is to move
+    if (side == black)
+        finalKey ^= sideKey;
 
-int castle;
+    return finalKey;
+}
 
+// move generation types
 enum {
-    allMoves,
-    onlyCaptures
+    genAll,
+    genCaptures,
+    genQuiets,
+    genEvasions
 };
 
-// is square attacked by given side
-static inline int isSquareAttacked(int square, int side) {
+// is square attacked by given side with the given pieces on the board
+static inline int isSquareAttackedThrough(int square, int side, U64 occupancy) {
     if ((side == white) && (pawnAttacks[black][square] & bitboards[P]))
     {
         return 1;
@@ -807,143 +987,250 @@ static inline int isSquareAttacked(int square, int side) {
         return 1;
     }
 
-    if (getBishopAttacks(square, occupancies[both]) & ((side == white) ? bitboards[B] : bitboards[b]))
+    if (getBishopAttacks(square, occupancy) & ((side == white) ? bitboards[B] : bitboards[b]))
     {
         return 1;
     }
 
-    if (getRookAttacks(square, occupancies[both]) & ((side == white) ? bitboards[R] : bitboards[r]))
+    if (getRookAttacks(square, occupancy) & ((side == white) ? bitboards[R] : bitboards[r]))
     {
         return 1;
     }
 
-    if (getQueenAttacks(square, occupancies[both]) & ((side == white) ? bitboards[Q] : bitboards[q]))
+    if (getQueenAttacks(square, occupancy) & ((side == white) ? bitboards[Q] : bitboards[q]))
     {
         return 1;
     }
     return 0;
 }
 
-static inline int makeMove(int move, int moveFlag) {
-    // quiet moves
-    if (moveFlag == allMoves)
+// is square attacked by given side
+static inline int isSquareAttacked(int square, int side) {
+    return isSquareAttackedThrough(square, side, occupancies[both]);
+}
+
+// pieces of both sides attacking square, sliders seen through the given occupancy
+static inline U64 attackersTo(int square, U64 occupancy) {
+    U64 diagonal = bitboards[B] | bitboards[b] | bitboards[Q] | bitboards[q];
+    U64 orthogonal = bitboards[R] | bitboards[r] | bitboards[Q] | bitboards[q];
+
+    return (pawnAttacks[black][square] & bitboards[P])
+           | (pawnAttacks[white][square] & bitboards[p])
+           | (knightAttacks[square] & (bitboards[N] | bitboards[n]))
+           | (kingAttacks[square] & (bitboards[K] | bitboards[k]))
+           | (getBishopAttacks(square, occupancy) & diagonal)
+           | (getRookAttacks(square, occupancy) & orthogonal);
+}
+
+// rook squares of a castling move given the king target square
+static inline void getCastlingRook(int kingTarget, int *rook, U64 *rookFromTo, int *rookFrom, int *rookTo) {
+    switch (kingTarget)
     {
-        copy_board();
+        // white castle kingside
+        case g1:
+            *rook = R, *rookFrom = h1, *rookTo = f1;
+            break;
+        // white castle queenside
+        case c1:
+            *rook = R, *rookFrom = a1, *rookTo = d1;
+            break;
+        // black castle kingside
+        case g8:
+            *rook = r, *rookFrom = h8, *rookTo = f8;
+            break;
+        // black castle queenside
+        default:
+            *rook = r, *rookFrom = a8, *rookTo = d8;
+            break;
+    }
+    *rookFromTo = (1ULL << *rookFrom) | (1ULL << *rookTo);
+}
 
-        int source = move_get_source(move);
-        int target = move_get_target(move);
-        int piece = move_get_piece(move);
-        int promotedPiece = move_get_promoted(move);
-        int capture = move_get_capture(move);
-        int doublePush = move_get_doublepush(move);
-        int enpass = move_get_enpassant(move);
-        int castling = move_get_castling(move);
+// take back the last move made with makeMove
+static inline void unmakeMove(int move) {
+    // pop undo record
+    undo_info *undo = &undoStack[--undoIndex];
 
-        // move piece
-        pop_bit(bitboards[piece], source);
-        set_bit(bitboards[piece], target);
+    // side that made the move
+    side ^= 1;
 
-        if (capture) // Handle captures
-        {
-            for (int enemyPieceIdx = P + ((1 - side) * 6); enemyPieceIdx <= K + ((1 - side) * 6); enemyPieceIdx++)
-            {
-                if (get_bit(bitboards[enemyPieceIdx], target))
-                {
-                    pop_bit(bitboards[enemyPieceIdx], target);
-                    break;
-                }
-            }
-        }
-        if (promotedPiece) // Handle promotions
-        {
-            // First, remove pawn and add the piece its promoting to
-            pop_bit(bitboards[P + (6 * side)], source);
-            set_bit(bitboards[promotedPiece], target);
-        }
-        if (enpass)
-        {
-            (side == white) ? pop_bit(bitboards[p], target + 8) : pop_bit(bitboards[P], target - 8);
+    int source = move_get_source(move);
+    int target = move_get_target(move);
+    int piece = move_get_piece(move);
+    int promotedPiece = move_get_promoted(move);
 
-            set_bit(bitboards[piece], target);
-        }
-        enpassant = no_sq;
-        if (doublePush)
-        {
-            enpassant = (side == white) ? target + 8 : target - 8;
-        }
+    U64 fromTo = (1ULL << source) | (1ULL << target);
 
-        if (castling)
-        {
-            switch (target)
-            {
-                // white castle kingside
-                case g1:
-                    pop_bit(bitboards[R], h1);
-                    set_bit(bitboards[R], f1);
-                    break;
-                // white castle queenside
-                case c1:
-                    pop_bit(bitboards[R], a1);
-                    set_bit(bitboards[R], d1);
-                    break;
-                // black castle kingside
-                case g8:
-                    pop_bit(bitboards[r], h8);
-                    set_bit(bitboards[r], f8);
-                    break;
-                // black castle queenside
-                case c8:
-                    pop_bit(bitboards[r], a8);
-                    set_bit(bitboards[r], d8);
-                    break;
-            }
-        }
-        // Update castling rights
-        // Check square where piece is moving or targeting, if its king or rook square, update the rights
-        castle &= castling_rights[source];
-        castle &= castling_rights[target];
+    // turn the promoted piece back into a pawn
+    if (promotedPiece)
+    {
+        bitboards[promotedPiece] ^= 1ULL << target;
+        bitboards[piece] ^= 1ULL << target;
+    }
 
-        // Reset occupancies
-        memset(occupancies, 0ULL, 24);
+    // move piece back
+    bitboards[piece] ^= fromTo;
+    occupancies[side] ^= fromTo;
+    pieceOnSquare[source] = piece;
+    pieceOnSquare[target] = no_piece;
 
-        for (int bbPiece = P; bbPiece <= K; bbPiece++)
-        {
-            occupancies[white] |= bitboards[bbPiece];
-            occupancies[both] |= bitboards[bbPiece];
-        }
-        for (int bbPiece = p; bbPiece <= k; bbPiece++)
-        {
-            occupancies[black] |= bitboards[bbPiece];
-            occupancies[both] |= bitboards[bbPiece];
-        }
-        // change side
-        side ^= 1;
+    // put captured piece back
+    if (move_get_capture(move))
+    {
+        int capturedSquare = target;
+        if (move_get_enpassant(move))
+            capturedSquare = (side == white) ? target + 8 : target - 8;
 
-        // make sure king is not in check
-        if (isSquareAttacked((side == white) ? getLSBIndex(bitboards[k]) : getLSBIndex(bitboards[K]), side))
-        {
-            // move is illegal
-            restore_board();
+        bitboards[undo->capturedPiece] ^= 1ULL << capturedSquare;
+        occupancies[side ^ 1] ^= 1ULL << capturedSquare;
+        pieceOnSquare[capturedSquare] = undo->capturedPiece;
+    }
 
-            return 0;
-        } else
+    // move castling rook back
+    if (move_get_castling(move))
+    {
+        int rook, rookFrom, rookTo;
+        U64 rookFromTo;
+        getCastlingRook(target, &rook, &rookFromTo, &rookFrom, &rookTo);
+
+        bitboards[rook] ^= rookFromTo;
+        occupancies[side] ^= rookFromTo;
+        pieceOnSquare[rookFrom] = rook;
+        pieceOnSquare[rookTo] = no_piece;
+    }
+
+    occupancies[both] = occupancies[white] | occupancies[black];
+
+    // restore irreversible state
+    castle = undo->castle;
+    enpassant = undo->enpassant;
+    hashKey = undo->hashKey;
+}
+
+// moves come from the legal generator or passed isLegal, the king is safe
+static inline void makeMove(int move) {
+    int source = move_get_source(move);
+    int target = move_get_target(move);
+    int piece = move_get_piece(move);
+    int promotedPiece = move_get_promoted(move);
+    int capture = move_get_capture(move);
+    int doublePush = move_get_doublepush(move);
+    int enpass = move_get_enpassant(move);
+    int castling = move_get_castling(move);
+
+    // push undo record
+    undo_info *undo = &undoStack[undoIndex++];
+    undo->castle = castle;
+    undo->enpassant = enpassant;
+    undo->hashKey = hashKey;
+
+    U64 fromTo = (1ULL << source) | (1ULL << target);
+
+    // move piece
+    bitboards[piece] ^= fromTo;
+    occupancies[side] ^= fromTo;
+    pieceOnSquare[source] = no_piece;
+    pieceOnSquare[target] = promotedPiece ? promotedPiece : piece;
+
+    // hash piece
+    hashKey ^= pieceKeys[piece][source];
+    hashKey ^= pieceKeys[piece][target];
+
+    if (capture) // Handle captures
+    {
+        // en passant captures the pawn behind the target square
+        int capturedSquare = target;
+        int capturedPiece = move_get_captured(move);
+
+        if (enpass)
         {
-            // move is legal
-            return 1;
+            capturedSquare = (side == white) ? target + 8 : target - 8;
+            pieceOnSquare[capturedSquare] = no_piece;
         }
+
+        bitboards[capturedPiece] ^= 1ULL << capturedSquare;
+        occupancies[side ^ 1] ^= 1ULL << capturedSquare;
+
+        // remove captured piece from hash key
+        hashKey ^= pieceKeys[capturedPiece][capturedSquare];
+
+        undo->capturedPiece = capturedPiece;
     }
-    // capture moves
-    else
+    if (promotedPiece) // Handle promotions
     {
-        // make sure move is the capture
-        if (move_get_capture(move))
-            makeMove(move, allMoves);
+        // First, remove pawn and add the piece its promoting to
+        pop_bit(bitboards[piece], target);
+        set_bit(bitboards[promotedPiece], target);
 
-            // otherwise the move is not a capture
-        else
-            // don't make it
-            return 0;
+        hashKey ^= pieceKeys[piece][target];
+        hashKey ^= pieceKeys[promotedPiece][target];
+    }
+
+    // hash out previous en passant square
+    if (enpassant != no_sq)
+        hashKey ^= enpassantKeys[enpassant];
+
+    enpassant = no_sq;
+    if (doublePush)
+    {
+        enpassant = (side == white) ? target + 8 : target - 8;
+        hashKey ^= enpassantKeys[enpassant];
     }
+
+    if (castling)
+    {
+        int rook, rookFrom, rookTo;
+        U64 rookFromTo;
+        getCastlingRook(target, &rook, &rookFromTo, &rookFrom, &rookTo);
+
+        bitboards[rook] ^= rookFromTo;
+        occupancies[side] ^= rookFromTo;
+        pieceOnSquare[rookFrom] = no_piece;
+        pieceOnSquare[rookTo] = rook;
+
+        hashKey ^= pieceKeys[rook][rookFrom];
+        hashKey ^= pieceKeys[rook][rookTo];
+    }
+    // Update castling rights
+    // Check square where piece is moving or targeting, if its king or rook square, update the rights
+    hashKey ^= castleKeys[castle];
+    castle &= castling_rights[source];
+    castle &= castling_rights[target];
+    hashKey ^= castleKeys[castle];
+
+    occupancies[both] = occupancies[white] | occupancies[black];
+
+    // change side
+    side ^= 1;
+    hashKey ^= sideKey;
+}
+
+// pass the turn, only side, en passant and the hash key change
+static inline void makeNullMove() {
+    // push undo record
+    undo_info *undo = &undoStack[undoIndex++];
+    undo->castle = castle;
+    undo->enpassant = enpassant;
+    undo->hashKey = hashKey;
+
+    // hash out previous en passant square
+    if (enpassant != no_sq)
+        hashKey ^= enpassantKeys[enpassant];
+
+    enpassant = no_sq;
+
+    // change side
+    side ^= 1;
+    hashKey ^= sideKey;
+}
+
+static inline void unmakeNullMove() {
+    // pop undo record
+    undo_info *undo = &undoStack[--undoIndex];
+
+    side ^= 1;
+    enpassant = undo->enpassant;
+    hashKey = undo->hashKey;
 }
 
 void printBoard() {
@@ -954,15 +1241,8 @@ void printBoard() {
         for (int file = 0; file < 8; file++)
         {
             int square = rank * 8 + file;
-            int piece = -1;
-            for (int bitboardPiece = P; bitboardPiece <= k; bitboardPiece++)
-            {
-                if (get_bit(bitboards[bitboardPiece], square))
-                {
-                    piece = bitboardPiece;
-                }
-            }
-            printf(" %c", (piece == -1) ? '.' : ascii_pieces[piece]);
+            int piece = pieceOnSquare[square];
+            printf(" %c", (piece == no_piece) ? '.' : ascii_pieces[piece]);
         }
         printf("\n");
     }
@@ -983,53 +1263,162 @@ void printBoard() {
     // }
 }
 
-static inline void generateMoves(moves *moveList) {
+// add pawn promotions of the given kind to the move list
+static inline void addPromotions(moves *moveList, int source, int target, int piece, int capture, int queen,
+                                 int underPromotions) {
+    // promoted pieces of the moving side
+    int offset = (piece == P) ? 0 : 6;
+
+    // captured piece travels with the move
+    int captured = capture ? move_set_captured(pieceOnSquare[target]) : 0;
+
+    if (queen)
+        addMoveToMoveList(moveList, move_encode(source, target, piece, Q + offset, capture, 0, 0, 0) | captured);
+
+    if (underPromotions)
+    {
+        addMoveToMoveList(moveList, move_encode(source, target, piece, R + offset, capture, 0, 0, 0) | captured);
+        addMoveToMoveList(moveList, move_encode(source, target, piece, B + offset, capture, 0, 0, 0) | captured);
+        addMoveToMoveList(moveList, move_encode(source, target, piece, N + offset, capture, 0, 0, 0) | captured);
+    }
+}
+
+// enemy pieces giving check to the king of the side to move
+static inline U64 getCheckers() {
+    int kingSquare = getLSBIndex(bitboards[K + 6 * side]);
+    int enemy = 6 * (side ^ 1);
+
+    return (pawnAttacks[side][kingSquare] & bitboards[P + enemy]) |
+           (knightAttacks[kingSquare] & bitboards[N + enemy]) |
+           (getBishopAttacks(kingSquare, occupancies[both]) & (bitboards[B + enemy] | bitboards[Q + enemy])) |
+           (getRookAttacks(kingSquare, occupancies[both]) & (bitboards[R + enemy] | bitboards[Q + enemy]));
+}
+
+// en passant removes two pawns from one line, make sure no slider sees the king afterwards
+static inline int isEnpassantSafe(int source, int capturedSquare, int kingSquare) {
+    int enemy = 6 * (side ^ 1);
+    U64 occupancy = (occupancies[both] ^ (1ULL << source) ^ (1ULL << capturedSquare)) | (1ULL << enpassant);
+
+    return !(getRookAttacks(kingSquare, occupancy) & (bitboards[R + enemy] | bitboards[Q + enemy])) &&
+           !(getBishopAttacks(kingSquare, occupancy) & (bitboards[B + enemy] | bitboards[Q + enemy]));
+}
+
+/*
+ * Generate legal moves of the given type
+ *
+ * - genAll       all moves
+ * - genCaptures  captures and queen promotions
+ * - genQuiets    non captures except queen promotions, castling included
+ * - genEvasions  all moves, named for the picker which uses it in check
+ *
+ * checkers and pins are found once per call: pieces other than the king
+ * only go to squares that resolve a check, pinned pieces stay on their
+ * pin ray and the king only steps to squares the enemy doesn't attack
+ */
+static inline void generateMoves(moves *moveList, int type) {
     // Initialize moves
     moveList->count = 0;
     int sourceSquare, targetSquare;
 
     // current piece bitboard copy
     U64 bitboard, attacks;
-    for (int piece = P + (6 * side); piece <= k - (6 * (1 - side)); piece++)
-    // If side is black, start at index 6, else 0 and end at 12 - 6
-    {
-        // printf("Moves for - %c\n", ascii_pieces[piece]);
-        //  init piece bitboard copy
-        bitboard = bitboards[piece];
 
-        if (piece == P) // White pawns
-        {
-            while (bitboard)
-            {
-                sourceSquare = getLSBIndex(bitboard);
-                targetSquare = sourceSquare - 8;
+    // which halves of the move set to emit
+    int noisy = (type != genQuiets);
+    int quiet = (type != genCaptures);
 
-                if (!(targetSquare < a8) && !get_bit(occupancies[both], targetSquare))
-                {
-                    // pawn promotion
-                    if (sourceSquare >= a7 && sourceSquare <= h7)
-                    {
-                        // Add white pawn promotion to list
-                        addMoveToMoveList(moveList, move_encode(sourceSquare, targetSquare, piece, Q, 0, 0, 0, 0));
-                        addMoveToMoveList(moveList, move_encode(sourceSquare, targetSquare, piece, R, 0, 0, 0, 0));
-                        addMoveToMoveList(moveList, move_encode(sourceSquare, targetSquare, piece, N, 0, 0, 0, 0));
-                        addMoveToMoveList(moveList, move_encode(sourceSquare, targetSquare, piece, B, 0, 0, 0, 0));
-                    } else
+    // target squares for pieces other than king
+    U64 targetMask = ~occupancies[side];
+    if (type == genCaptures)
+        targetMask = occupancies[side ^ 1];
+    if (type == genQuiets)
+        targetMask = ~occupancies[both];
+
+    // king may step anywhere the type allows
+    U64 kingMask = targetMask;
+
+    int kingSquare = getLSBIndex(bitboards[K + 6 * side]);
+    int enemy = 6 * (side ^ 1);
+
+    // squares that resolve the check when captured or blocked, all when not in check
+    U64 checkMask = ~0ULL;
+    U64 checkers = getCheckers();
+
+    if (checkers)
+    {
+        // double check, only the king can move
+        if (countBits(checkers) > 1)
+            checkMask = 0ULL;
+        else
+            checkMask = checkers | squaresBetween[kingSquare][getLSBIndex(checkers)];
+    }
+
+    targetMask &= checkMask;
+
+    // own pieces pinned to the king, pinRays[square] is the line a pinned piece may still use
+    U64 pinned = 0ULL;
+    U64 pinRays[64];
+
+    // enemy sliders that would see the king through one own piece
+    U64 snipers = (getRookAttacks(kingSquare, occupancies[side ^ 1]) & (bitboards[R + enemy] | bitboards[Q + enemy])) |
+                  (getBishopAttacks(kingSquare, occupancies[side ^ 1]) & (bitboards[B + enemy] | bitboards[Q + enemy]));
+
+    while (snipers)
+    {
+        int sniperSquare = getLSBIndex(snipers);
+        U64 blockers = squaresBetween[kingSquare][sniperSquare] & occupancies[both];
+
+        if (blockers && !(blockers & (blockers - 1)) && (blockers & occupancies[side]))
+        {
+            pinned |= blockers;
+            pinRays[getLSBIndex(blockers)] = squaresBetween[kingSquare][sniperSquare] | (1ULL << sniperSquare);
+        }
+
+        pop_lsb(snipers);
+    }
+
+    for (int piece = P + (6 * side); piece <= k - (6 * (1 - side)); piece++)
+    // If side is black, start at index 6, else 0 and end at 12 - 6
+    {
+        // printf("Moves for - %c\n", ascii_pieces[piece]);
+        //  init piece bitboard copy
+        bitboard = bitboards[piece];
+
+        if (piece == P) // White pawns
+        {
+            while (bitboard)
+            {
+                sourceSquare = getLSBIndex(bitboard);
+                targetSquare = sourceSquare - 8;
+
+                // squares this pawn may go to without leaving the king in check
+                U64 legalMask = checkMask & (get_bit(pinned, sourceSquare) ? pinRays[sourceSquare] : ~0ULL);
+
+                if (!(targetSquare < a8) && !get_bit(occupancies[both], targetSquare))
+                {
+                    // pawn promotion
+                    if (sourceSquare >= a7 && sourceSquare <= h7)
+                    {
+                        // Add white pawn promotion to list
+                        if (get_bit(legalMask, targetSquare))
+                            addPromotions(moveList, sourceSquare, targetSquare, piece, 0, noisy, quiet);
+                    } else if (quiet)
                     {
                         // double pawn push
                         if ((sourceSquare >= a2 && sourceSquare <= h2) && (!
-                                get_bit(occupancies[both], targetSquare - 8)))
+                                get_bit(occupancies[both], targetSquare - 8)) && get_bit(legalMask, targetSquare - 8))
                         {
                             // Add white double pawn push
                             addMoveToMoveList(
                                 moveList, move_encode(sourceSquare, targetSquare - 8, piece, 0, 0, 1, 0, 0));
                         }
                         // Add white single pawn move
-                        addMoveToMoveList(moveList, move_encode(sourceSquare, targetSquare, piece, 0, 0, 0, 0, 0));
+                        if (get_bit(legalMask, targetSquare))
+                            addMoveToMoveList(moveList, move_encode(sourceSquare, targetSquare, piece, 0, 0, 0, 0, 0));
                     }
                 }
                 // init pawn attack bitboard
-                attacks = pawnAttacks[side][sourceSquare] & occupancies[black];
+                attacks = noisy ? pawnAttacks[side][sourceSquare] & occupancies[black] & legalMask : 0ULL;
                 while (attacks)
                 {
                     targetSquare = getLSBIndex(attacks);
@@ -1037,34 +1426,34 @@ static inline void generateMoves(moves *moveList) {
                     if (sourceSquare >= a7 && sourceSquare <= h7)
                     {
                         // Add white pawn promotion while attacking
-                        addMoveToMoveList(moveList, move_encode(sourceSquare, targetSquare, piece, Q, 1, 0, 0, 0));
-                        addMoveToMoveList(moveList, move_encode(sourceSquare, targetSquare, piece, R, 1, 0, 0, 0));
-                        addMoveToMoveList(moveList, move_encode(sourceSquare, targetSquare, piece, B, 1, 0, 0, 0));
-                        addMoveToMoveList(moveList, move_encode(sourceSquare, targetSquare, piece, N, 1, 0, 0, 0));
+                        addPromotions(moveList, sourceSquare, targetSquare, piece, 1, 1, 1);
                     } else
                     {
                         // Add white pawn normal attack
-                        addMoveToMoveList(moveList, move_encode(sourceSquare, targetSquare, piece, 0, 1, 0, 0, 0));
+                        addMoveToMoveList(moveList, move_encode(sourceSquare, targetSquare, piece, 0, 1, 0, 0, 0) |
+                                                    move_set_captured(pieceOnSquare[targetSquare]));
                     }
-                    pop_bit(attacks, targetSquare);
+                    pop_lsb(attacks);
                 }
-                if (enpassant != no_sq)
+                // en passant either captures the checking pawn or blocks on the en passant square
+                if (noisy && enpassant != no_sq && (get_bit(checkMask, enpassant) || get_bit(checkMask, enpassant + 8)))
                 {
                     // handle en passant google it
                     U64 enPassantAttacks = pawnAttacks[side][sourceSquare] & (1ULL << enpassant);
-                    if (enPassantAttacks)
+                    if (enPassantAttacks && isEnpassantSafe(sourceSquare, enpassant + 8, kingSquare))
                     {
                         // init enpassant capture target
                         int targetEnpassant = getLSBIndex(enPassantAttacks); // Not the enemy pawn, the one behind him
-                        addMoveToMoveList(moveList, move_encode(sourceSquare, targetEnpassant, piece, 0, 1, 0, 1, 0));
+                        addMoveToMoveList(moveList, move_encode(sourceSquare, targetEnpassant, piece, 0, 1, 0, 1, 0) |
+                                                    move_set_captured(p));
                     }
                 }
                 // Final pop from piece bitboard copy
-                pop_bit(bitboard, sourceSquare);
+                pop_lsb(bitboard);
             }
         }
 
-        if (piece == K) // White king
+        if (piece == K && (type == genAll || type == genQuiets)) // White king
         {
             // kingside castling is available
             if (castle & wk)
@@ -1073,7 +1462,7 @@ static inline void generateMoves(moves *moveList) {
                 if (!get_bit(occupancies[both], g1) && !get_bit(occupancies[both], f1))
                 {
                     // make sure it doesnt put king in check
-                    if (!isSquareAttacked(e1, black) && !isSquareAttacked(f1, black))
+                    if (!isSquareAttacked(e1, black) && !isSquareAttacked(f1, black) && !isSquareAttacked(g1, black))
                     {
                         // Add white king side castle to moves
                         addMoveToMoveList(moveList, move_encode(e1, g1, piece, 0, 0, 0, 0, 1));
@@ -1088,7 +1477,7 @@ static inline void generateMoves(moves *moveList) {
                         occupancies[both], b1))
                 {
                     // make sure it doesnt put king in check
-                    if (!isSquareAttacked(e1, black) && !isSquareAttacked(d1, black))
+                    if (!isSquareAttacked(e1, black) && !isSquareAttacked(d1, black) && !isSquareAttacked(c1, black))
                     {
                         // Add white queen side castle to moves
                         addMoveToMoveList(moveList, move_encode(e1, c1, piece, 0, 0, 0, 0, 1));
@@ -1104,64 +1493,66 @@ static inline void generateMoves(moves *moveList) {
                 sourceSquare = getLSBIndex(bitboard);
                 targetSquare = sourceSquare + 8;
 
+                // squares this pawn may go to without leaving the king in check
+                U64 legalMask = checkMask & (get_bit(pinned, sourceSquare) ? pinRays[sourceSquare] : ~0ULL);
+
                 if (!(targetSquare > h1) && !get_bit(occupancies[both], targetSquare))
                 {
                     // pawn promotion
                     if (sourceSquare >= a2 && sourceSquare <= h2)
                     {
                         // Add black pawn promotion to move list
-                        addMoveToMoveList(moveList, move_encode(sourceSquare, targetSquare, piece, q, 0, 0, 0, 0));
-                        addMoveToMoveList(moveList, move_encode(sourceSquare, targetSquare, piece, r, 0, 0, 0, 0));
-                        addMoveToMoveList(moveList, move_encode(sourceSquare, targetSquare, piece, n, 0, 0, 0, 0));
-                        addMoveToMoveList(moveList, move_encode(sourceSquare, targetSquare, piece, b, 0, 0, 0, 0));
-                    } else
+                        if (get_bit(legalMask, targetSquare))
+                            addPromotions(moveList, sourceSquare, targetSquare, piece, 0, noisy, quiet);
+                    } else if (quiet)
                     {
                         if ((sourceSquare >= a7 && sourceSquare <= h7) && (!
-                                get_bit(occupancies[both], targetSquare + 8)))
+                                get_bit(occupancies[both], targetSquare + 8)) && get_bit(legalMask, targetSquare + 8))
                         {
                             // Add black double push pawn
                             addMoveToMoveList(
                                 moveList, move_encode(sourceSquare, targetSquare + 8, piece, 0, 0, 1, 0, 0));
                         }
                         // Single black pawn move
-                        addMoveToMoveList(moveList, move_encode(sourceSquare, targetSquare, piece, 0, 0, 0, 0, 0));
+                        if (get_bit(legalMask, targetSquare))
+                            addMoveToMoveList(moveList, move_encode(sourceSquare, targetSquare, piece, 0, 0, 0, 0, 0));
                     }
                 }
                 // init pawn attack bitboard
-                attacks = pawnAttacks[side][sourceSquare] & occupancies[white];
+                attacks = noisy ? pawnAttacks[side][sourceSquare] & occupancies[white] & legalMask : 0ULL;
                 while (attacks)
                 {
                     targetSquare = getLSBIndex(attacks);
                     if (sourceSquare >= a2 && sourceSquare <= h2)
                     {
                         // Add black attack promotion to move list
-                        addMoveToMoveList(moveList, move_encode(sourceSquare, targetSquare, piece, q, 1, 0, 0, 0));
-                        addMoveToMoveList(moveList, move_encode(sourceSquare, targetSquare, piece, r, 1, 0, 0, 0));
-                        addMoveToMoveList(moveList, move_encode(sourceSquare, targetSquare, piece, b, 1, 0, 0, 0));
-                        addMoveToMoveList(moveList, move_encode(sourceSquare, targetSquare, piece, n, 1, 0, 0, 0));
+                        addPromotions(moveList, sourceSquare, targetSquare, piece, 1, 1, 1);
                     } else
                     {
                         // Add black normal attack to move list
-                        addMoveToMoveList(moveList, move_encode(sourceSquare, targetSquare, piece, 0, 1, 0, 0, 0));
+                        addMoveToMoveList(moveList, move_encode(sourceSquare, targetSquare, piece, 0, 1, 0, 0, 0) |
+                                                    move_set_captured(pieceOnSquare[targetSquare]));
                     }
-                    pop_bit(attacks, targetSquare);
+                    pop_lsb(attacks);
                 }
-                if (enpassant != no_sq)
+                // en passant either captures the checking pawn or blocks on the en passant square
+                if (noisy && enpassant != no_sq && (get_bit(checkMask, enpassant) || get_bit(checkMask, enpassant - 8)))
                 {
                     // handle en passant google it
                     U64 enPassantAttacks = pawnAttacks[side][sourceSquare] & (1ULL << enpassant);
-                    if (enPassantAttacks)
+                    if (enPassantAttacks && isEnpassantSafe(sourceSquare, enpassant - 8, kingSquare))
                     {
                         // init enpassant capture target
                         targetSquare = getLSBIndex(enPassantAttacks);
-                        addMoveToMoveList(moveList, move_encode(sourceSquare, targetSquare, piece, 0, 1, 0, 1, 0));
+                        addMoveToMoveList(moveList, move_encode(sourceSquare, targetSquare, piece, 0, 1, 0, 1, 0) |
+                                                    move_set_captured(P));
                     }
                 }
                 // final pop
-                pop_bit(bitboard, sourceSquare);
+                pop_lsb(bitboard);
             }
         }
-        if (piece == k) // Black king
+        if (piece == k && (type == genAll || type == genQuiets)) // Black king
         {
             // kingside castling is available
             if (castle & bk)
@@ -1170,7 +1561,7 @@ static inline void generateMoves(moves *moveList) {
                 if (!get_bit(occupancies[both], g8) && !get_bit(occupancies[both], f8))
                 {
                     // make sure it doesnt put king in check
-                    if (!isSquareAttacked(e8, white) && !isSquareAttacked(f8, white))
+                    if (!isSquareAttacked(e8, white) && !isSquareAttacked(f8, white) && !isSquareAttacked(g8, white))
                     {
                         // Add black kingside castle
                         addMoveToMoveList(moveList, move_encode(e8, g8, piece, 0, 0, 0, 0, 1));
@@ -1185,7 +1576,7 @@ static inline void generateMoves(moves *moveList) {
                         occupancies[both], b8))
                 {
                     // make sure it doesnt put king in check
-                    if (!isSquareAttacked(e8, white) && !isSquareAttacked(d8, white))
+                    if (!isSquareAttacked(e8, white) && !isSquareAttacked(d8, white) && !isSquareAttacked(c8, white))
                     {
                         // Add black queenside castle
                         addMoveToMoveList(moveList, move_encode(e8, c8, piece, 0, 0, 0, 0, 1));
@@ -1200,7 +1591,8 @@ static inline void generateMoves(moves *moveList) {
                 // init source square
                 sourceSquare = getLSBIndex(bitboard);
 
-                attacks = knightAttacks[sourceSquare] & ~occupancies[side];
+                attacks = knightAttacks[sourceSquare] & targetMask
+                          & (get_bit(pinned, sourceSquare) ? pinRays[sourceSquare] : ~0ULL);
 
                 // loop over target squares
                 while (attacks)
@@ -1209,16 +1601,17 @@ static inline void generateMoves(moves *moveList) {
                     if (get_bit(occupancies[1 - side], targetSquare))
                     {
                         // Add horsey capture moves
-                        addMoveToMoveList(moveList, move_encode(sourceSquare, targetSquare, piece, 0, 1, 0, 0, 0));
+                        addMoveToMoveList(moveList, move_encode(sourceSquare, targetSquare, piece, 0, 1, 0, 0, 0) |
+                                                    move_set_captured(pieceOnSquare[targetSquare]));
                     } else
                     {
                         // Add horsey normal noves
                         addMoveToMoveList(moveList, move_encode(sourceSquare, targetSquare, piece, 0, 0, 0, 0, 0));
                     }
-                    pop_bit(attacks, targetSquare);
+                    pop_lsb(attacks);
                 }
 
-                pop_bit(bitboard, sourceSquare);
+                pop_lsb(bitboard);
             }
         }
 
@@ -1229,7 +1622,8 @@ static inline void generateMoves(moves *moveList) {
                 // init source square
                 sourceSquare = getLSBIndex(bitboard);
 
-                attacks = getBishopAttacks(sourceSquare, occupancies[both]) & ~occupancies[side];
+                attacks = getBishopAttacks(sourceSquare, occupancies[both]) & targetMask
+                          & (get_bit(pinned, sourceSquare) ? pinRays[sourceSquare] : ~0ULL);
 
                 // loop over target squares
                 while (attacks)
@@ -1238,16 +1632,17 @@ static inline void generateMoves(moves *moveList) {
                     if (get_bit(occupancies[1 - side], targetSquare))
                     {
                         // Add bishop capture moves
-                        addMoveToMoveList(moveList, move_encode(sourceSquare, targetSquare, piece, 0, 1, 0, 0, 0));
+                        addMoveToMoveList(moveList, move_encode(sourceSquare, targetSquare, piece, 0, 1, 0, 0, 0) |
+                                                    move_set_captured(pieceOnSquare[targetSquare]));
                     } else
                     {
                         // Add bishop normal moves
                         addMoveToMoveList(moveList, move_encode(sourceSquare, targetSquare, piece, 0, 0, 0, 0, 0));
                     }
-                    pop_bit(attacks, targetSquare);
+                    pop_lsb(attacks);
                 }
 
-                pop_bit(bitboard, sourceSquare);
+                pop_lsb(bitboard);
             }
         }
         if (piece == R || piece == r)
@@ -1257,7 +1652,8 @@ static inline void generateMoves(moves *moveList) {
                 // init source square
                 sourceSquare = getLSBIndex(bitboard);
 
-                attacks = getRookAttacks(sourceSquare, occupancies[both]) & ~occupancies[side];
+                attacks = getRookAttacks(sourceSquare, occupancies[both]) & targetMask
+                          & (get_bit(pinned, sourceSquare) ? pinRays[sourceSquare] : ~0ULL);
 
                 // loop over target squares
                 while (attacks)
@@ -1266,16 +1662,17 @@ static inline void generateMoves(moves *moveList) {
                     if (get_bit(occupancies[1 - side], targetSquare))
                     {
                         // Add rook capture moves
-                        addMoveToMoveList(moveList, move_encode(sourceSquare, targetSquare, piece, 0, 1, 0, 0, 0));
+                        addMoveToMoveList(moveList, move_encode(sourceSquare, targetSquare, piece, 0, 1, 0, 0, 0) |
+                                                    move_set_captured(pieceOnSquare[targetSquare]));
                     } else
                     {
                         // Add rook normal moves
                         addMoveToMoveList(moveList, move_encode(sourceSquare, targetSquare, piece, 0, 0, 0, 0, 0));
                     }
-                    pop_bit(attacks, targetSquare);
+                    pop_lsb(attacks);
                 }
 
-                pop_bit(bitboard, sourceSquare);
+                pop_lsb(bitboard);
             }
         }
         if (piece == Q || piece == q)
@@ -1285,7 +1682,8 @@ static inline void generateMoves(moves *moveList) {
                 // init source square
                 sourceSquare = getLSBIndex(bitboard);
 
-                attacks = getQueenAttacks(sourceSquare, occupancies[both]) & ~occupancies[side];
+                attacks = getQueenAttacks(sourceSquare, occupancies[both]) & targetMask
+                          & (get_bit(pinned, sourceSquare) ? pinRays[sourceSquare] : ~0ULL);
 
                 // loop over target squares
                 while (attacks)
@@ -1294,16 +1692,17 @@ static inline void generateMoves(moves *moveList) {
                     if (get_bit(occupancies[1 - side], targetSquare))
                     {
                         // Add queen capture moves
-                        addMoveToMoveList(moveList, move_encode(sourceSquare, targetSquare, piece, 0, 1, 0, 0, 0));
+                        addMoveToMoveList(moveList, move_encode(sourceSquare, targetSquare, piece, 0, 1, 0, 0, 0) |
+                                                    move_set_captured(pieceOnSquare[targetSquare]));
                     } else
                     {
                         // Add queen normal moves
                         addMoveToMoveList(moveList, move_encode(sourceSquare, targetSquare, piece, 0, 0, 0, 0, 0));
                     }
-                    pop_bit(attacks, targetSquare);
+                    pop_lsb(attacks);
                 }
 
-                pop_bit(bitboard, sourceSquare);
+                pop_lsb(bitboard);
             }
         }
         if (piece == K || piece == k)
@@ -1313,35 +1712,277 @@ static inline void generateMoves(moves *moveList) {
                 // init source square
                 sourceSquare = getLSBIndex(bitboard);
 
-                attacks = kingAttacks[sourceSquare] & ~occupancies[side];
+                attacks = kingAttacks[sourceSquare] & kingMask;
+
+                // the king doesn't shield squares behind it along a checking ray
+                U64 kingless = occupancies[both] ^ (1ULL << sourceSquare);
 
                 // loop over target squares
                 while (attacks)
                 {
                     targetSquare = getLSBIndex(attacks);
-                    if (get_bit(occupancies[1 - side], targetSquare))
+                    if (isSquareAttackedThrough(targetSquare, side ^ 1, kingless))
+                    {
+                        // can't step into check
+                    } else if (get_bit(occupancies[1 - side], targetSquare))
                     {
                         // Add king capture moves
-                        addMoveToMoveList(moveList, move_encode(sourceSquare, targetSquare, piece, 0, 1, 0, 0, 0));
+                        addMoveToMoveList(moveList, move_encode(sourceSquare, targetSquare, piece, 0, 1, 0, 0, 0) |
+                                                    move_set_captured(pieceOnSquare[targetSquare]));
                     } else
                     {
                         // Add king normal moves
                         addMoveToMoveList(moveList, move_encode(sourceSquare, targetSquare, piece, 0, 0, 0, 0, 0));
                     }
-                    pop_bit(attacks, targetSquare);
+                    pop_lsb(attacks);
                 }
 
-                pop_bit(bitboard, sourceSquare);
+                pop_lsb(bitboard);
+            }
+        }
+    }
+}
+
+/**********************************\
+              Time control
+\**********************************/
+
+// monotonic wall clock time in milliseconds
+long long getTimeMs() {
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (counter.QuadPart * 1000) / frequency.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+#endif
+}
+
+// safety margin for GUI / OS latency in ms
+#define move_overhead 50
+
+// check the clock every (node_check_interval + 1) nodes
+#define node_check_interval 2047
+
+// search start time
+long long startTime = 0;
+
+// don't start another iteration after this time
+long long softStopTime = 0;
+
+// abort the running iteration after this time
+long long hardStopTime = 0;
+
+// time control flag
+int timeSet = 0;
+
+// node limit, 0 for none
+long long nodesLimit = 0;
+
+// set when the search has to return immediately, read by all search threads
+volatile int stopped = 0;
+
+// searching the expected reply on the opponent's time, the clock starts at ponderhit
+int pondering = 0;
+
+// "go infinite", bestmove waits for stop even after the last iteration
+int infiniteSearch = 0;
+
+// limits of a ponder search, applied relative to ponderhit
+int ponderTimeSet = 0;
+long long ponderSoftTime = 0;
+long long ponderHardTime = 0;
+
+// quit or end of input arrived while searching
+int quitRequested = 0;
+
+/**********************************\
+              UCI input
+\**********************************/
+
+// lines read during a search that uciLoop handles afterwards, the queue
+// doubles when full, stop and quit have to be read however much is queued
+#define input_queue_size 8
+#define input_line_size 2000
+
+char (*inputQueue)[input_line_size] = NULL;
+int inputQueueCapacity = 0;
+int inputQueueCount = 0;
+
+// set by uciLoop, command line tools never read stdin while searching
+int uciInput = 0;
+
+// set once the search has a move to answer with, stdin is polled from then on
+int pollInput = 0;
+
+// 1 when a read from stdin wouldn't block
+int inputWaiting() {
+#ifdef _WIN32
+    static int init = 0, pipe;
+    static HANDLE inputHandle;
+    DWORD available;
+
+    if (!init)
+    {
+        init = 1;
+        inputHandle = GetStdHandle(STD_INPUT_HANDLE);
+        pipe = !GetConsoleMode(inputHandle, &available);
+
+        if (!pipe)
+        {
+            SetConsoleMode(inputHandle, available & ~(ENABLE_MOUSE_INPUT | ENABLE_WINDOW_INPUT));
+            FlushConsoleInputBuffer(inputHandle);
+        }
+    }
+
+    // a broken pipe reads as input, so end of input isn't missed
+    if (pipe)
+        return !PeekNamedPipe(inputHandle, NULL, 0, NULL, &available, NULL) || available;
+
+    GetNumberOfConsoleInputEvents(inputHandle, &available);
+    return available > 1;
+#else
+    fd_set readSet;
+    struct timeval timeout = {0, 0};
+
+    FD_ZERO(&readSet);
+    FD_SET(fileno(stdin), &readSet);
+
+    return select(fileno(stdin) + 1, &readSet, NULL, NULL, &timeout) > 0;
+#endif
+}
+
+// switch a ponder search to the real clock, it keeps its tree and iterations
+void ponderHit() {
+    if (!pondering)
+        return;
+
+    long long now = getTimeMs();
+
+    pondering = 0;
+    softStopTime = now + ponderSoftTime;
+    hardStopTime = now + ponderHardTime;
+    timeSet = ponderTimeSet;
+}
+
+// commands the GUI may send while the engine thinks, anything else is queued
+void handleSearchInput(char *input) {
+    if (strncmp(input, "stop", 4) == 0)
+    {
+        stopped = 1;
+    } else if (strncmp(input, "quit", 4) == 0)
+    {
+        stopped = 1;
+        quitRequested = 1;
+    } else if (strncmp(input, "ponderhit", 9) == 0)
+    {
+        ponderHit();
+    } else if (strncmp(input, "isready", 7) == 0)
+    {
+        printf("readyok\n");
+    } else if (input[0] != '\n')
+    {
+        if (inputQueueCount == inputQueueCapacity)
+        {
+            int capacity = inputQueueCapacity ? inputQueueCapacity * 2 : input_queue_size;
+            char (*queue)[input_line_size] = realloc(inputQueue, capacity * sizeof(inputQueue[0]));
+
+            if (queue == NULL)
+            {
+                printf("info string couldn't queue %s", input);
+                return;
             }
+
+            inputQueue = queue;
+            inputQueueCapacity = capacity;
+        }
+
+        strcpy(inputQueue[inputQueueCount++], input);
+    }
+}
+
+// poll stdin from the search, called by the main search thread only
+void readInput() {
+    char input[input_line_size];
+
+    while (inputWaiting())
+    {
+        if (!fgets(input, sizeof(input), stdin))
+        {
+            // GUI is gone, stop and quit
+            stopped = 1;
+            quitRequested = 1;
+            return;
         }
+
+        handleSearchInput(input);
+    }
+}
+
+// next command for uciLoop, queued lines first, 0 at the end of input
+int readCommand(char *input) {
+    if (inputQueueCount)
+    {
+        strcpy(input, inputQueue[0]);
+        memmove(inputQueue[0], inputQueue[1], (--inputQueueCount) * sizeof(inputQueue[0]));
+        return 1;
     }
+
+    return fgets(input, input_line_size, stdin) != NULL;
 }
 
 /**********************************\
               Perft stuff
 \**********************************/
 // leaf nodes (number of positions reached during testing)
-long nodes;
+per_thread long long nodes;
+
+/*
+ * Perft hash entry - 16 bytes
+ *
+ * - key   position key xor data, torn writes from other threads fail the check
+ * - data  leaf count of the subtree shifted left by 8, remaining depth in the low 8 bits
+ */
+typedef struct {
+    U64 key;
+    U64 data;
+} perft_entry;
+
+// perft cache, NULL when disabled
+perft_entry *perftHash = NULL;
+
+// number of entries in the perft cache (power of two)
+U64 perftHashEntries = 0;
+
+// cache statistics of the calling thread
+per_thread long long perftHashProbes;
+per_thread long long perftHashHits;
+
+// allocate the perft cache, 0 MB turns it off
+void initPerftHash(int megabytes) {
+    free(perftHash);
+    perftHash = NULL;
+    perftHashEntries = 0;
+
+    if (megabytes < 1)
+        return;
+
+    U64 entries = ((U64) megabytes * 1024 * 1024) / sizeof(perft_entry);
+    perftHashEntries = 1;
+    while (perftHashEntries * 2 <= entries)
+        perftHashEntries *= 2;
+
+    perftHash = calloc(perftHashEntries, sizeof(perft_entry));
+
+    if (perftHash == NULL)
+    {
+        printf("info string couldn't allocate %d MB perft hash, running without it\n", megabytes);
+        perftHashEntries = 0;
+    }
+}
 // perft driver
 
 static inline void perftDriver(int depth) {
@@ -1351,66 +1992,215 @@ static inline void perftDriver(int depth) {
         nodes++;
         return;
     }
-    moves moveList[1];
-    generateMoves(moveList);
 
-    for (int moveCount = 0; moveCount < moveList->count; moveCount++)
+    perft_entry *entry = NULL;
+
+    // subtree reached by transposition was counted already
+    if (perftHash && depth > 1)
     {
-        copy_board();
-        if (!makeMove(moveList->moves[moveCount], allMoves))
+        entry = &perftHash[hashKey & (perftHashEntries - 1)];
+        U64 data = entry->data;
+
+        perftHashProbes++;
+
+        if ((entry->key ^ data) == hashKey && (int) (data & 0xff) == depth)
         {
-            continue;
+            perftHashHits++;
+            nodes += (long long) (data >> 8);
+            return;
         }
+    }
+
+    long long subtreeStart = nodes;
+    moves moveList[1];
+    generateMoves(moveList, genAll);
+
+    // every generated move is legal, count the leaves without playing them
+    if (depth == 1)
+    {
+        nodes += moveList->count;
+        return;
+    }
+
+    for (int moveCount = 0; moveCount < moveList->count; moveCount++)
+    {
+        makeMove(moveList->moves[moveCount]);
+
         perftDriver(depth - 1);
 
-        restore_board();
+        unmakeMove(moveList->moves[moveCount]);
+    }
+
+    if (entry)
+    {
+        U64 data = ((U64) (nodes - subtreeStart) << 8) | (U64) depth;
+
+        entry->data = data;
+        entry->key = hashKey ^ data;
     }
 }
 
 // pertf test
+/*
+ * Perft work item
+ *
+ * a root move, or a root move and one reply when the root is narrow,
+ * counted by whichever worker picks it up
+ */
+typedef struct {
+    int rootMove;
+    int childMove;
+    long long nodes;
+    long long hashProbes;
+    long long hashHits;
+} perft_item;
+
+perft_item perftItems[256 * 256];
+int perftItemCount;
+int nextPerftItem;
+int perftDepth;
+board_state perftPosition;
+
+// legal moves of the current position
+static inline int generateLegalMoves(int *legalMoves) {
+    moves moveList[1];
+    generateMoves(moveList, genAll);
+
+    memcpy(legalMoves, moveList->moves, moveList->count * sizeof(int));
+
+    return moveList->count;
+}
+
+void *perftWorker(void *argument) {
+    loadBoardState(&perftPosition);
+
+    int itemIndex;
+
+    while ((itemIndex = atomic_fetch_increment(&nextPerftItem)) < perftItemCount)
+    {
+        perft_item *item = &perftItems[itemIndex];
+        int depth = perftDepth - 1;
+
+        nodes = 0;
+        perftHashProbes = 0;
+        perftHashHits = 0;
+        makeMove(item->rootMove);
+
+        if (item->childMove)
+        {
+            makeMove(item->childMove);
+            perftDriver(depth - 1);
+            unmakeMove(item->childMove);
+        } else
+        {
+            perftDriver(depth);
+        }
+
+        unmakeMove(item->rootMove);
+        item->nodes = nodes;
+        item->hashProbes = perftHashProbes;
+        item->hashHits = perftHashHits;
+    }
+
+    return argument;
+}
+
+// perft divide over threadCount workers, output doesn't depend on the thread count
 void perftTest(int depth) {
     printf("\nPerformance test\n");
-    int start = GetTickCount();
-    moves moveList[1];
-    generateMoves(moveList);
-    int move;
+    long long start = getTimeMs();
 
-    for (int moveCount = 0; moveCount < moveList->count; moveCount++)
+    if (depth < 1) depth = 1;
+
+    int rootMoves[256];
+    int rootCount = generateLegalMoves(rootMoves);
+
+    // split narrow roots one ply deeper so every worker has something to do
+    int splitChildren = depth > 1 && rootCount < 4 * threadCount;
+
+    perftItemCount = 0;
+
+    for (int rootIndex = 0; rootIndex < rootCount; rootIndex++)
     {
-        move = moveList->moves[moveCount];
-        copy_board();
-        if (!makeMove(moveList->moves[moveCount], allMoves))
+        if (!splitChildren)
         {
+            perftItems[perftItemCount++] = (perft_item) {rootMoves[rootIndex], 0, 0, 0, 0};
             continue;
         }
 
-        long cumulativeNodes = nodes;
+        int childMoves[256];
 
-        // call driver recursively
-        perftDriver(depth - 1);
+        makeMove(rootMoves[rootIndex]);
+        int childCount = generateLegalMoves(childMoves);
+        unmakeMove(rootMoves[rootIndex]);
+
+        for (int childIndex = 0; childIndex < childCount; childIndex++)
+            perftItems[perftItemCount++] = (perft_item) {rootMoves[rootIndex], childMoves[childIndex], 0, 0, 0};
+    }
+
+    // counts from earlier runs would skew the hit rate
+    if (perftHash)
+        memset(perftHash, 0, perftHashEntries * sizeof(perft_entry));
+
+    saveBoardState(&perftPosition);
+    perftDepth = depth;
+    nextPerftItem = 0;
+
+    thread_handle workers[max_threads];
+
+    for (int thread = 0; thread < threadCount; thread++)
+        thread_create(&workers[thread], perftWorker, NULL);
 
-        long oldNodes = nodes - cumulativeNodes;
+    for (int thread = 0; thread < threadCount; thread++)
+        thread_join(workers[thread]);
 
-        restore_board();
+    // sum items back per root move, in generation order
+    long long totalNodes = 0;
+    long long hashProbes = 0;
+    long long hashHits = 0;
+    int itemIndex = 0;
+
+    for (int item = 0; item < perftItemCount; item++)
+    {
+        hashProbes += perftItems[item].hashProbes;
+        hashHits += perftItems[item].hashHits;
+    }
+
+    for (int rootIndex = 0; rootIndex < rootCount; rootIndex++)
+    {
+        int move = rootMoves[rootIndex];
+        long long moveNodes = 0;
+
+        while (itemIndex < perftItemCount && perftItems[itemIndex].rootMove == move)
+            moveNodes += perftItems[itemIndex++].nodes;
+
+        totalNodes += moveNodes;
+
+        printf("    move: ");
         printMove(move);
-        printf("    move: %s%s%c   nodes: %ld\n",
-               square_to_coordinate[move_get_source(move_get_source(move))],
-               square_to_coordinate[move_get_target(move)],
-               promoted_pieces_c[move_get_promoted(move)],
-               oldNodes);
+        printf("   nodes: %lld\n", moveNodes);
     }
 
     printf("\n    Depth : %d\n", depth);
-    printf("    Nodes : %ld\n", nodes);
-    printf("    Time  : %ldms", GetTickCount() - start);
+    printf("    Nodes : %lld\n", totalNodes);
+    long long elapsed = getTimeMs() - start;
+    printf("    Time  : %lldms\n", elapsed);
+    printf("    NPS   : %lld\n", totalNodes * 1000 / (elapsed + 1));
+
+    if (perftHash)
+        printf("    Hash  : %.1f%% hits of %lld probes\n",
+               hashProbes ? 100.0 * hashHits / hashProbes : 0.0, hashProbes);
 }
 
 void parseFENString(char *FEN) {
     // Reset board position and occupancies (set to 0ULL)
     memset(bitboards, 0ULL, sizeof(bitboards));
     memset(occupancies, 0ULL, sizeof(occupancies));
+    for (int square = 0; square < 64; square++)
+        pieceOnSquare[square] = no_piece;
     // Reset gameState
     side = 0;
+    undoIndex = 0;
     enpassant = no_sq;
     castle = 0;
 
@@ -1421,6 +2211,7 @@ void parseFENString(char *FEN) {
         {
             int square = rank * 8 + file;
             int offset = 1;
+            int placed = 0;
 
             // match ascii characters
             if ((*FEN >= 'a' && *FEN <= 'z') || (*FEN >= 'A' && *FEN <= 'Z'))
@@ -1428,6 +2219,8 @@ void parseFENString(char *FEN) {
                 int piece = char_pieces[*FEN];
 
                 set_bit(bitboards[piece], square);
+                pieceOnSquare[square] = piece;
+                placed = 1;
                 *FEN++;
             }
             if (*FEN >= '0' && *FEN <= '9')
@@ -1435,11 +2228,9 @@ void parseFENString(char *FEN) {
                 // offset fen
                 offset = *FEN - '0';
 
-                file += offset;
-                if (*(FEN - 1) == '/')
-                {
-                    file--;
-                }
+                // without a piece the current square is the first empty one
+                // (checking the previous character missed a leading digit)
+                file += placed ? offset : offset - 1;
                 *FEN++;
             }
 
@@ -1506,17 +2297,9 @@ void parseFENString(char *FEN) {
         occupancies[black] |= bitboards[piece];
     }
     occupancies[both] = occupancies[white] | occupancies[black];
-}
-
-/**********************************\
-              Init all
-\**********************************/
 
-void init_all() {
-    // findMagicNumber();
-    initLeaperAttacks();
-    initSliderAttacks(bishop);
-    initSliderAttacks(rook);
+    // init hash key
+    hashKey = generateHashKey();
 }
 
 // print attacked squares given side
@@ -1541,7 +2324,7 @@ int parseMove(char *moveString) {
     // "d4e6n"
     moves moveList[1];
 
-    generateMoves(moveList);
+    generateMoves(moveList, genAll);
 
     int sourceSquare = (moveString[0] - 'a') + (8 - (moveString[1] - '0')) * 8;
     int targetSquare = (moveString[2] - 'a') + (8 - (moveString[3] - '0')) * 8;
@@ -1737,7 +2520,7 @@ static inline int evaluate() {
                 default:
                     break;
             }
-            pop_bit(bitboard, square);
+            pop_lsb(bitboard);
         }
     }
 
@@ -1764,256 +2547,1996 @@ static int mvv_lva[12][12] = {
 };
 
 // half move counter
-int ply;
+per_thread int ply;
 
-// best move
-int bestMove;
+// max ply that can be reached within a search
+#define max_ply 64
 
-static inline int scoreMove(int move) {
-    if (move_get_capture(move))
-    {
-        // init target piece
-        int targetPiece = P;
+/*
+ * Triangular PV table
+ *
+ * pvTable[ply] holds the principal variation found from that ply on,
+ * pvLength[ply] is the ply at which that variation ends.
+ *
+ *   ply 0: m1 m2 m3 m4
+ *   ply 1:    m2 m3 m4
+ *   ply 2:       m3 m4
+ *   ply 3:          m4
+ *
+ * the node at max_ply only ends the variation of its parent, so pvLength
+ * has one slot more
+ */
+per_thread int pvLength[max_ply + 1];
+per_thread int pvTable[max_ply + 1][max_ply];
 
-        for (int enemyPieceIdx = P + ((1 - side) * 6); enemyPieceIdx <= K + ((1 - side) * 6); enemyPieceIdx++)
-        {
-            if (get_bit(bitboards[enemyPieceIdx], move_get_target(move)))
-            {
-                targetPiece = enemyPieceIdx;
-            }
-        }
+/*
+ * Killer moves [id][ply]
+ *
+ * quiet moves that caused a beta cutoff at the same ply
+ * in a sibling node, most recent one in slot 0
+ */
+per_thread int killerMoves[2][max_ply];
 
-        // score by MVV LVA lookup
-        return mvv_lva[move_get_piece(move)][targetPiece];
-    } else
-    {
-    }
+// history moves [piece][target square], bonus for quiet moves causing cutoffs
+per_thread int historyMoves[12][64];
 
-    return 0;
-}
+// history scores stay below the killer scores
+#define max_history 7000
 
-void print_move_scores(moves *move_list) {
-    printf("     Move scores:\n\n");
+// cut node statistics, first move cutoff rate = firstMoveCutoffs / betaCutoffs
+per_thread long long betaCutoffs;
+per_thread long long firstMoveCutoffs;
 
-    // loop over moves within a move list
-    for (int count = 0; count < move_list->count; count++)
-    {
-        printf("     move: ");
-        printMove(move_list->moves[count]);
-        printf(" score: %d\n", scoreMove(move_list->moves[count]));
-    }
-}
+// follow the PV of the previous iteration
+per_thread int followPV;
 
-static inline int sortMoves(moves *moveList) {
- 
-    int moveScores[moveList->count];
+// null move pruning, the reduction grows with depth: R = null_move_reduction + depth / 4
+#define null_move_min_depth 3
+#define null_move_reduction 3
 
-    for (int count = 0; count < moveList->count; count++)
-    {
-        moveScores[count] = scoreMove(moveList->moves[count]);
-    }
+// null move fail highs from this depth on are confirmed by a reduced normal search
+#define null_move_verify_depth 10
 
-    for (int current = 0; current<moveList->count; current++)
-    {
-        for (int next = current + 1; next<moveList->count; next++)
-        {
-            if (moveScores[current] < moveScores[next])
-            {
-                int tempScore = moveScores[current];
-                moveScores[current] = moveScores[next];
-                moveScores[next] = tempScore;
+// the move made at this ply was a null move, two in a row would only lose depth
+per_thread int nullMovePlayed[max_ply];
 
-                int tempMove = moveList->moves[current];
-                moveList->moves[current] = moveList->moves[next];
-                moveList->moves[next] = tempMove;
-            }
-        }
-    }
-}
+// quiescence captures are pruned when eval + victim + delta_margin stays below alpha
+#define delta_margin 200
+
+// pruning near the leaves, only with depth <= leaf_pruning_depth left
+#define leaf_pruning_depth 3
+
+// static eval this far above beta fails high without a search (reverse futility)
+#define reverse_futility_margin(depth) (120 * (depth))
+
+// static eval this far below alpha makes quiet moves futile
+#define futility_margin(depth) (100 + 100 * (depth))
+
+// static eval this far below alpha drops straight into quiescence (razoring)
+#define razoring_margin(depth) (200 + 150 * (depth))
+
+// late move reductions: moves after the first few, from this depth on
+#define lmr_full_depth_moves 3
+#define lmr_min_depth 3
+
+// base reduction [depth][move number], log(depth) * log(move number) shaped
+int lmrReductions[max_ply][64];
+
+void initLmrReductions() {
+    for (int depth = 1; depth < max_ply; depth++)
+        for (int moveNumber = 1; moveNumber < 64; moveNumber++)
+            lmrReductions[depth][moveNumber] = (int) (0.75 + log(depth) * log(moveNumber) / 2.25);
+}
+
+// no null moves before this ply while a verification search runs
+per_thread int nullMoveMinPly;
+
+// aspiration windows from this depth on, half width set by the AspirationWindow option
+#define aspiration_min_depth 4
+#define default_aspiration_delta 40
+
+int aspirationDelta = default_aspiration_delta;
+
+// aspiration statistics of the calling thread
+per_thread long long aspirationIterations;
+per_thread long long aspirationFailLows;
+per_thread long long aspirationFailHighs;
+
+// score of the last completed iteration of the main thread
+int searchScore;
+
+// completed iterations whose PV ended before their depth without mate or
+// stalemate, the bench reports them and they should stay at 0
+long long shortPVs;
+
+/**********************************\
+              Hash table
+\**********************************/
+
+// search bounds, mate scores have to fit the short score of a hash entry
+#define infinity 32000
+#define mate_value 31000
+#define mate_score 30000
+
+// max search depth
+#define max_depth 64
+
+// no hash entry found constant
+#define no_hash_entry 100000
+
+// default hash table size in MB
+#define default_hash_size 64
+
+// hash flag (bound type) encoding
+#define hash_flag_exact 0
+#define hash_flag_alpha 1
+#define hash_flag_beta 2
+
+// entries per bucket, one bucket fills exactly one 64 byte cache line
+#define bucket_size 4
+
+/*
+ * Transposition table entry - 16 bytes
+ *
+ * - hashKey  full 64 bit key of the stored position xor data, so an entry
+ *            torn by two threads writing at once fails the key check
+ * - move     best move found (0 if none)
+ * - score    score of the position (mate scores relative to the node)
+ * - depth    remaining depth of the search that produced the entry
+ * - flag     bound type in the low 2 bits, search age in the upper 6 bits
+ */
+typedef struct {
+    U64 hashKey;
+    union {
+        struct {
+            int move;
+            short score;
+            unsigned char depth;
+            unsigned char flag;
+        };
+        U64 data;
+    };
+} tt_entry;
+
+typedef struct {
+    tt_entry entries[bucket_size];
+} tt_bucket;
+
+// hash table, aligned to the cache line size
+tt_bucket *hashTable = NULL;
+
+// raw allocation backing the aligned hash table
+void *hashTableMemory = NULL;
+
+// number of buckets in the hash table (power of two)
+U64 hashBuckets = 0;
+
+// current search age, stored in the upper 6 bits of the entry flag
+int hashAge = 0;
+
+#define hash_get_bound(flag) ((flag) & 3)
+#define hash_get_age(flag) ((flag) >> 2)
+
+// position key an entry was stored for
+#define hash_entry_key(entry) ((entry)->hashKey ^ (entry)->data)
+
+// clear hash table
+void clearHashTable() {
+    memset(hashTable, 0, hashBuckets * sizeof(tt_bucket));
+    hashAge = 0;
+}
+
+// allocate hash table of the given size in MB
+void initHashTable(int megabytes) {
+    // free previous allocation
+    if (hashTableMemory != NULL)
+        free(hashTableMemory);
+
+    // round bucket count down to the power of two so indexing is a mask
+    U64 buckets = ((U64) megabytes * 1024 * 1024) / sizeof(tt_bucket);
+    hashBuckets = 1;
+    while (hashBuckets * 2 <= buckets)
+        hashBuckets *= 2;
+
+    // over allocate by one cache line and align the table manually
+    hashTableMemory = malloc(hashBuckets * sizeof(tt_bucket) + 64);
+
+    if (hashTableMemory == NULL)
+    {
+        printf("info string couldn't allocate %d MB hash, falling back to 1 MB\n", megabytes);
+        initHashTable(1);
+        return;
+    }
+
+    hashTable = (tt_bucket *) (((size_t) hashTableMemory + 63) & ~(size_t) 63);
+
+    clearHashTable();
+}
+
+// bucket the given key maps to
+static inline tt_bucket *getHashBucket(U64 key) {
+    return &hashTable[key & (hashBuckets - 1)];
+}
+
+// start loading the bucket of the given key into cache
+static inline void prefetchHashEntry(U64 key) {
+    __builtin_prefetch(getHashBucket(key));
+}
+
+// read hash entry data, returns no_hash_entry if the score can't be used
+static inline int readHashEntry(int alpha, int beta, int depth, int *hashMove) {
+    tt_bucket *bucket = getHashBucket(hashKey);
+
+    for (int index = 0; index < bucket_size; index++)
+    {
+        // other threads may write the entry meanwhile, work on a copy
+        tt_entry copy = bucket->entries[index];
+        tt_entry *entry = &copy;
+
+        // make sure we're dealing with the exact position
+        if (hash_entry_key(entry) != hashKey)
+            continue;
+
+        // hash move is useful for ordering regardless of the depth
+        *hashMove = entry->move;
+
+        if (entry->depth >= depth)
+        {
+            int score = entry->score;
+
+            // mate scores are stored relative to the node, convert to distance from root
+            if (score < -mate_score) score += ply;
+            if (score > mate_score) score -= ply;
+
+            int bound = hash_get_bound(entry->flag);
+
+            if (bound == hash_flag_exact)
+                return score;
+
+            if ((bound == hash_flag_alpha) && (score <= alpha))
+                return alpha;
+
+            if ((bound == hash_flag_beta) && (score >= beta))
+                return beta;
+        }
+
+        break;
+    }
+
+    return no_hash_entry;
+}
+
+// hash move of the current position whatever the entry's depth, 0 without one
+static inline int probeHashMove() {
+    tt_bucket *bucket = getHashBucket(hashKey);
+
+    for (int index = 0; index < bucket_size; index++)
+    {
+        // other threads may write the entry meanwhile, work on a copy
+        tt_entry copy = bucket->entries[index];
+
+        if (hash_entry_key(&copy) == hashKey)
+            return copy.move;
+    }
+
+    return 0;
+}
+
+// write hash entry data
+static inline void writeHashEntry(int score, int depth, int hashFlag, int move) {
+    tt_bucket *bucket = getHashBucket(hashKey);
+
+    // pick the slot to overwrite
+    tt_entry *replace = &bucket->entries[0];
+
+    for (int index = 0; index < bucket_size; index++)
+    {
+        tt_entry *entry = &bucket->entries[index];
+
+        // same position, always overwrite
+        if (hash_entry_key(entry) == hashKey)
+        {
+            replace = entry;
+            break;
+        }
+
+        // otherwise prefer replacing stale and then shallow entries
+        int entryWorth = entry->depth - 8 * ((hashAge - hash_get_age(entry->flag)) & 63);
+        int replaceWorth = replace->depth - 8 * ((hashAge - hash_get_age(replace->flag)) & 63);
+
+        if (entryWorth < replaceWorth)
+            replace = entry;
+    }
+
+    // keep previous best move if this search didn't find one
+    if (move == 0 && hash_entry_key(replace) == hashKey)
+        move = replace->move;
+
+    // store mate scores relative to the node
+    if (score < -mate_score) score -= ply;
+    if (score > mate_score) score += ply;
+
+    tt_entry entry;
+    entry.move = move;
+    entry.score = (short) score;
+    entry.depth = (unsigned char) depth;
+    entry.flag = (unsigned char) (hashFlag | (hashAge << 2));
+
+    replace->data = entry.data;
+    replace->hashKey = hashKey ^ entry.data;
+}
+
+// hash table usage in permill, sampled from the first 1000 entries
+int hashFull() {
+    int used = 0;
+
+    for (int index = 0; index < 1000 / bucket_size; index++)
+    {
+        for (int entry = 0; entry < bucket_size; entry++)
+        {
+            tt_entry *current = &hashTable[index].entries[entry];
+
+            if (current->hashKey && hash_get_age(current->flag) == hashAge)
+                used++;
+        }
+    }
+
+    return used;
+}
+
+// captures and queen promotions, the moves generated by genCaptures
+static inline int isNoisy(int move) {
+    return move_get_capture(move) || move_get_promoted(move) == Q || move_get_promoted(move) == q;
+}
+
+static inline int scoreMove(int move) {
+    if (move_get_capture(move))
+    {
+        // score by MVV LVA lookup, captures go before killers
+        return mvv_lva[move_get_piece(move)][move_get_captured(move)] + 10000;
+    } else if (isNoisy(move))
+    {
+        // queen promotion wins about as much as capturing a queen
+        return mvv_lva[move_get_piece(move)][Q] + 10000;
+    } else
+    {
+        // score 1st killer move
+        if (killerMoves[0][ply] == move)
+            return 9000;
+
+        // score 2nd killer move
+        if (killerMoves[1][ply] == move)
+            return 8000;
+
+        // score history move
+        return historyMoves[move_get_piece(move)][move_get_target(move)];
+    }
+}
+
+// age history scores so older cutoffs weigh less
+static inline void ageHistory() {
+    for (int piece = P; piece <= k; piece++)
+    {
+        for (int square = 0; square < 64; square++)
+        {
+            historyMoves[piece][square] /= 2;
+        }
+    }
+}
+
+// reward a quiet move that caused a beta cutoff
+static inline void updateQuietHeuristics(int move, int depth) {
+    // store killer moves
+    if (killerMoves[0][ply] != move)
+    {
+        killerMoves[1][ply] = killerMoves[0][ply];
+        killerMoves[0][ply] = move;
+    }
+
+    // store history moves
+    int *history = &historyMoves[move_get_piece(move)][move_get_target(move)];
+    *history += depth * depth;
+
+    // keep history below killer scores
+    if (*history > max_history)
+        ageHistory();
+}
+
+void print_move_scores(moves *move_list) {
+    printf("     Move scores:\n\n");
+
+    // loop over moves within a move list
+    for (int count = 0; count < move_list->count; count++)
+    {
+        printf("     move: ");
+        printMove(move_list->moves[count]);
+        printf(" score: %d\n", scoreMove(move_list->moves[count]));
+    }
+}
+
+// could the move be generated in the current position (ignoring king safety)
+static inline int isPseudoLegal(int move) {
+    if (move == 0)
+        return 0;
+
+    int source = move_get_source(move);
+    int target = move_get_target(move);
+    int piece = move_get_piece(move);
+    int promotedPiece = move_get_promoted(move);
+
+    // moving piece must belong to the side to move and stand on the source square
+    if ((piece / 6) != side || !get_bit(bitboards[piece], source))
+        return 0;
+
+    // can't land on own piece
+    if (get_bit(occupancies[side], target))
+        return 0;
+
+    // castling, same conditions as in generateMoves
+    if (move_get_castling(move))
+    {
+        if (piece == K && source == e1 && target == g1)
+            return (castle & wk) && !get_bit(occupancies[both], f1) && !get_bit(occupancies[both], g1) &&
+                   !isSquareAttacked(e1, black) && !isSquareAttacked(f1, black);
+        if (piece == K && source == e1 && target == c1)
+            return (castle & wq) && !get_bit(occupancies[both], d1) && !get_bit(occupancies[both], c1) &&
+                   !get_bit(occupancies[both], b1) && !isSquareAttacked(e1, black) && !isSquareAttacked(d1, black);
+        if (piece == k && source == e8 && target == g8)
+            return (castle & bk) && !get_bit(occupancies[both], f8) && !get_bit(occupancies[both], g8) &&
+                   !isSquareAttacked(e8, white) && !isSquareAttacked(f8, white);
+        if (piece == k && source == e8 && target == c8)
+            return (castle & bq) && !get_bit(occupancies[both], d8) && !get_bit(occupancies[both], c8) &&
+                   !get_bit(occupancies[both], b8) && !isSquareAttacked(e8, white) && !isSquareAttacked(d8, white);
+        return 0;
+    }
+
+    // en passant lands on the en passant square behind the enemy pawn
+    if (move_get_enpassant(move))
+        return (piece == P || piece == p) && target == enpassant &&
+               (pawnAttacks[side][source] & (1ULL << target));
+
+    // capture flag must match target square
+    if ((move_get_capture(move) != 0) != (get_bit(occupancies[side ^ 1], target) != 0))
+        return 0;
+
+    // captured piece is encoded in the move
+    if (move_get_capture(move) && move_get_captured(move) != pieceOnSquare[target])
+        return 0;
+
+    if (piece == P || piece == p)
+    {
+        // promotion flag must match the last rank
+        int lastRank = (side == white) ? (target <= h8) : (target >= a1);
+        if (lastRank != (promotedPiece != 0))
+            return 0;
+        if (promotedPiece && (promotedPiece / 6) != side)
+            return 0;
+
+        if (move_get_capture(move))
+            return (pawnAttacks[side][source] & (1ULL << target)) != 0;
+
+        int direction = (side == white) ? -8 : 8;
+
+        // double pawn push from the initial rank over an empty square
+        if (move_get_doublepush(move))
+            return target == source + 2 * direction &&
+                   ((side == white) ? (source >= a2 && source <= h2) : (source >= a7 && source <= h7)) &&
+                   !get_bit(occupancies[both], source + direction) && !get_bit(occupancies[both], target);
+
+        return target == source + direction && !get_bit(occupancies[both], target);
+    }
+
+    // only pawns promote, push twice or capture en passant
+    if (promotedPiece || move_get_doublepush(move))
+        return 0;
+
+    switch (piece % 6)
+    {
+        case N:
+            return (knightAttacks[source] & (1ULL << target)) != 0;
+        case B:
+            return (getBishopAttacks(source, occupancies[both]) & (1ULL << target)) != 0;
+        case R:
+            return (getRookAttacks(source, occupancies[both]) & (1ULL << target)) != 0;
+        case Q:
+            return (getQueenAttacks(source, occupancies[both]) & (1ULL << target)) != 0;
+        case K:
+            return (kingAttacks[source] & (1ULL << target)) != 0;
+    }
+
+    return 0;
+}
+
+// pseudo legal move that doesn't leave the own king attacked, for moves
+// that didn't come from the generator like hash and killer moves
+static inline int isLegal(int move) {
+    if (!isPseudoLegal(move))
+        return 0;
+
+    int source = move_get_source(move);
+    int target = move_get_target(move);
+    int piece = move_get_piece(move);
+    int enemy = 6 * (side ^ 1);
+
+    int kingSquare = (piece % 6 == K) ? target : getLSBIndex(bitboards[K + 6 * side]);
+
+    // enemy piece removed by the move
+    U64 captured = 0ULL;
+    if (move_get_capture(move))
+        captured = 1ULL << (move_get_enpassant(move) ? target + ((side == white) ? 8 : -8) : target);
+
+    // occupancy after the move, castling moves the rook as well
+    U64 occupancy = ((occupancies[both] ^ (1ULL << source)) & ~captured) | (1ULL << target);
+
+    if (move_get_castling(move))
+    {
+        int rook, rookFrom, rookTo;
+        U64 rookFromTo;
+        getCastlingRook(target, &rook, &rookFromTo, &rookFrom, &rookTo);
+
+        occupancy ^= rookFromTo;
+    }
+
+    return !((pawnAttacks[side][kingSquare] & bitboards[P + enemy] & ~captured) ||
+             (knightAttacks[kingSquare] & bitboards[N + enemy] & ~captured) ||
+             (kingAttacks[kingSquare] & bitboards[K + enemy]) ||
+             (getBishopAttacks(kingSquare, occupancy) & (bitboards[B + enemy] | bitboards[Q + enemy]) & ~captured) ||
+             (getRookAttacks(kingSquare, occupancy) & (bitboards[R + enemy] | bitboards[Q + enemy]) & ~captured));
+}
+
+/**********************************\
+              Move picker
+\**********************************/
+
+// move picker stages, every stage is generated and scored only when reached
+enum {
+    stage_hash,
+    stage_init_captures,
+    stage_good_captures,
+    stage_killers,
+    stage_init_quiets,
+    stage_quiets,
+    stage_bad_captures,
+    stage_init_evasions,
+    stage_evasions,
+    stage_done
+};
+
+typedef struct {
+    // current stage
+    int stage;
+
+    // genAll in the main search, genCaptures in quiescence, genEvasions in check
+    int type;
+
+    // PV and hash move, tried before anything is generated
+    int hashMoves[2];
+    int hashIndex;
+
+    // killer moves of the current ply
+    int killers[2];
+    int killerIndex;
+
+    // generated moves, captures first and quiets behind them
+    int moves[256];
+    int scores[256];
+    int count;
+
+    // next move to pick and end of the current stage
+    int current;
+    int end;
+
+    // captures judged bad are moved to the front of the list
+    int badCount;
+
+    // first quiet move
+    int quietStart;
+} move_picker;
+
+static inline void initMovePicker(move_picker *picker, int pvMove, int hashMove, int type) {
+    picker->stage = stage_hash;
+    picker->type = type;
+
+    picker->hashMoves[0] = pvMove;
+    picker->hashMoves[1] = (hashMove != pvMove) ? hashMove : 0;
+    picker->hashIndex = 0;
+
+    picker->killers[0] = (type == genAll) ? killerMoves[0][ply] : 0;
+    picker->killers[1] = (type == genAll) ? killerMoves[1][ply] : 0;
+    picker->killerIndex = 0;
+
+    picker->count = 0;
+    picker->badCount = 0;
+}
+
+// already returned by the hash stage
+static inline int isHashMove(move_picker *picker, int move) {
+    return move == picker->hashMoves[0] || move == picker->hashMoves[1];
+}
+
+// partial selection sort, bring the best scored move of [current, end) to the front
+static inline int pickBest(move_picker *picker) {
+    int best = picker->current;
+
+    for (int index = picker->current + 1; index < picker->end; index++)
+    {
+        if (picker->scores[index] > picker->scores[best])
+            best = index;
+    }
+
+    int move = picker->moves[best];
+    int score = picker->scores[best];
+
+    picker->moves[best] = picker->moves[picker->current];
+    picker->scores[best] = picker->scores[picker->current];
+    picker->moves[picker->current] = move;
+    picker->scores[picker->current] = score;
+
+    picker->current++;
+
+    return move;
+}
+
+// exchange value of a piece of either colour
+#define see_value(piece) material_score[(piece) % 6]
+
+/*
+ * Static exchange evaluation
+ *
+ * material won by the move once both sides have recaptured on the target
+ * square with their least valuable attacker for as long as it pays off,
+ * removing an attacker uncovers the sliders behind it (x-rays)
+ */
+static inline int see(int move) {
+    int target = move_get_target(move);
+    int promoted = move_get_promoted(move);
+
+    // material balance after every capture, from the capturing side's view
+    int gain[32];
+    int depth = 0;
+
+    gain[0] = move_get_capture(move) ? see_value(move_get_captured(move)) : 0;
+
+    // piece standing on the target square, next to be captured
+    int onTarget = move_get_piece(move);
+
+    if (promoted)
+    {
+        gain[0] += see_value(promoted) - see_value(P);
+        onTarget = promoted;
+    }
+
+    U64 occupancy = occupancies[both] ^ (1ULL << move_get_source(move));
+
+    // en passant removes the pawn behind the target square
+    if (move_get_enpassant(move))
+        occupancy ^= 1ULL << ((side == white) ? target + 8 : target - 8);
+
+    U64 diagonal = bitboards[B] | bitboards[b] | bitboards[Q] | bitboards[q];
+    U64 orthogonal = bitboards[R] | bitboards[r] | bitboards[Q] | bitboards[q];
+    U64 attackers = attackersTo(target, occupancy) & occupancy;
+
+    int color = side ^ 1;
+
+    while (depth < 31)
+    {
+        U64 ownAttackers = attackers & occupancies[color];
+
+        if (!ownAttackers)
+            break;
+
+        // least valuable attacker, pieces are ordered pawn to king
+        int attacker = (color == white) ? P : p;
+        while (!(ownAttackers & bitboards[attacker]))
+            attacker++;
+
+        // the king can't recapture on a square that is still defended
+        if (attacker % 6 == K && (attackers & occupancies[color ^ 1]))
+            break;
+
+        depth++;
+        gain[depth] = see_value(onTarget) - gain[depth - 1];
+
+        occupancy ^= 1ULL << getLSBIndex(ownAttackers & bitboards[attacker]);
+
+        // sliders behind the capturing piece join in
+        attackers |= (getBishopAttacks(target, occupancy) & diagonal) | (getRookAttacks(target, occupancy) & orthogonal);
+        attackers &= occupancy;
+
+        onTarget = attacker;
+        color ^= 1;
+    }
+
+    // every side may stop capturing when continuing loses more
+    while (depth)
+    {
+        if (-gain[depth] < gain[depth - 1])
+            gain[depth - 1] = -gain[depth];
+
+        depth--;
+    }
+
+    return gain[0];
+}
+
+// capture losing material by static exchange evaluation
+static inline int isBadCapture(int move) {
+    if (!move_get_capture(move))
+        return 0;
+
+    // taking an equal or more valuable piece can't lose material
+    if (see_value(move_get_captured(move)) >= see_value(move_get_piece(move)))
+        return 0;
+
+    return see(move) < 0;
+}
+
+// generate moves of the given type at the end of the picker list and score them
+static inline void appendMoves(move_picker *picker, int type) {
+    moves moveList[1];
+    generateMoves(moveList, type);
+
+    for (int count = 0; count < moveList->count; count++)
+    {
+        picker->moves[picker->count] = moveList->moves[count];
+        picker->scores[picker->count] = scoreMove(moveList->moves[count]);
+        picker->count++;
+    }
+}
+
+// next move to search, 0 when there are no moves left
+static inline int nextMove(move_picker *picker) {
+    int move;
+
+    switch (picker->stage)
+    {
+        case stage_hash:
+            while (picker->hashIndex < 2)
+            {
+                move = picker->hashMoves[picker->hashIndex++];
+
+                // quiescence searches neither quiet moves nor losing captures
+                if (move && (picker->type != genCaptures || (isNoisy(move) && !isBadCapture(move))) && isLegal(move))
+                    return move;
+            }
+
+            picker->stage = (picker->type == genEvasions) ? stage_init_evasions : stage_init_captures;
+            return nextMove(picker);
+
+        case stage_init_captures:
+            // generate and score captures only, quiets wait until reached
+            appendMoves(picker, genCaptures);
+
+            picker->current = 0;
+            picker->end = picker->count;
+            picker->stage++;
+            // fall through
+
+        case stage_good_captures:
+            while (picker->current < picker->end)
+            {
+                move = pickBest(picker);
+
+                if (isHashMove(picker, move))
+                    continue;
+
+                // losing captures are searched after quiet moves
+                if (isBadCapture(move))
+                {
+                    picker->moves[picker->badCount++] = move;
+                    continue;
+                }
+
+                return move;
+            }
+
+            // quiescence prunes captures with a negative exchange
+            picker->stage = (picker->type == genCaptures) ? stage_done : stage_killers;
+            picker->current = 0;
+            return nextMove(picker);
+
+        case stage_killers:
+            while (picker->killerIndex < 2)
+            {
+                move = picker->killers[picker->killerIndex++];
+
+                if (move && !isHashMove(picker, move) && !isNoisy(move) && isLegal(move))
+                    return move;
+            }
+            picker->stage++;
+            // fall through
+
+        case stage_init_quiets:
+            picker->quietStart = picker->count;
+            appendMoves(picker, genQuiets);
+
+            picker->current = picker->quietStart;
+            picker->end = picker->count;
+            picker->stage++;
+            // fall through
+
+        case stage_quiets:
+            while (picker->current < picker->end)
+            {
+                move = pickBest(picker);
+
+                if (isHashMove(picker, move) || move == picker->killers[0] || move == picker->killers[1])
+                    continue;
+
+                return move;
+            }
+
+            picker->current = 0;
+            picker->stage++;
+            // fall through
+
+        case stage_bad_captures:
+            // bad captures are already in MVV LVA order
+            if (picker->current < picker->badCount)
+                return picker->moves[picker->current++];
+
+            picker->stage = stage_done;
+            return 0;
+
+        case stage_init_evasions:
+            // in check, captures and quiets come from the evasion generator in one go
+            appendMoves(picker, genEvasions);
+
+            picker->current = 0;
+            picker->end = picker->count;
+            picker->stage++;
+            // fall through
+
+        case stage_evasions:
+            while (picker->current < picker->end)
+            {
+                move = pickBest(picker);
+
+                if (isHashMove(picker, move))
+                    continue;
+
+                return move;
+            }
+
+            picker->stage = stage_done;
+            // fall through
+
+        default:
+            return 0;
+    }
+}
+
+/**********************************\
+              Threads
+\**********************************/
+
+// 0 for the main search thread, helpers count up from 1
+per_thread int threadId = 0;
+
+// node counts published by every search thread, one cache line each
+typedef struct {
+    volatile long long nodes;
+    char padding[56];
+} thread_nodes;
+
+thread_nodes threadNodes[max_threads];
+
+// root position and depth limit handed to helper threads
+board_state rootPosition;
+int rootDepth;
+
+// let the main thread see how far this thread got
+static inline void publishNodes() {
+    threadNodes[threadId].nodes = nodes;
+}
+
+// nodes searched by all threads of the running search
+long long totalNodes() {
+    long long total = nodes;
+
+    for (int thread = 1; thread < threadCount; thread++)
+        total += threadNodes[thread].nodes;
+
+    return total;
+}
+
+// stop the search once the hard deadline or node limit is hit, or the GUI says so
+static inline void checkUp() {
+    publishNodes();
+
+    if (timeSet && getTimeMs() >= hardStopTime)
+        stopped = 1;
+
+    if (nodesLimit && nodes >= nodesLimit)
+        stopped = 1;
+
+    // helpers leave stdin to the main thread
+    if (threadId == 0 && pollInput)
+        readInput();
+}
+
+static inline int quiescenceSearch(int alpha, int beta) {
+    // poll time and node limits every few thousand nodes
+    if ((nodes & node_check_interval) == 0)
+        checkUp();
+
+    nodes++;
+
+    // too deep, bail out before the ply indexed tables overflow
+    if (ply > max_ply - 1)
+        return evaluate();
+
+    // hash move of the current position
+    int hashMove = 0;
+
+    // read hash entry, qsearch entries are stored with depth 0
+    int score = readHashEntry(alpha, beta, 0, &hashMove);
+    if (ply && score != no_hash_entry)
+    {
+        // position was already searched, return its score
+        return score;
+    }
+
+    // evaluate position
+    int evaluation = evaluate();
+
+    // fail-hard beta cutoff
+    if (evaluation >= beta)
+    {
+        // node (move) fails high
+        return beta;
+    }
+
+    int hashFlag = hash_flag_alpha;
+    int bestMoveSoFar = 0;
+
+    // found a better move
+    if (evaluation > alpha)
+    {
+        // PV node (move)
+        alpha = evaluation;
+        hashFlag = hash_flag_exact;
+    }
+
+    // create move picker instance, captures and queen promotions only
+    move_picker picker[1];
+    initMovePicker(picker, 0, hashMove, genCaptures);
+
+    int move;
+
+    // loop over captures in picking order, losing ones are already left out
+    while ((move = nextMove(picker)))
+    {
+        // delta pruning: even winning the captured piece and a margin doesn't reach alpha
+        if (!move_get_promoted(move) && evaluation + see_value(move_get_captured(move)) + delta_margin <= alpha)
+            continue;
+
+        // increment ply
+        ply++;
+
+        makeMove(move);
+
+        // child position will probe the hash table first
+        prefetchHashEntry(hashKey);
+
+        // score current move
+        score = -quiescenceSearch(-beta, -alpha);
+
+        // decrement ply
+        ply--;
+
+        // take move back
+        unmakeMove(move);
+
+        // search was aborted, result is meaningless
+        if (stopped)
+            return 0;
+
+        // fail-hard beta cutoff
+        if (score >= beta)
+        {
+            writeHashEntry(beta, 0, hash_flag_beta, move);
+
+            // node (move) fails high
+            return beta;
+        }
+
+        // found a better move
+        if (score > alpha)
+        {
+            // PV node (move)
+            alpha = score;
+            hashFlag = hash_flag_exact;
+            bestMoveSoFar = move;
+        }
+    }
+
+    writeHashEntry(alpha, 0, hashFlag, bestMoveSoFar);
+
+    // node (move) fails low
+    return alpha;
+}
+
+// side to move has more than king and pawns, null moves fail in pawn endgame zugzwangs
+static inline int hasNonPawnMaterial() {
+    if (side == white)
+        return (bitboards[N] | bitboards[B] | bitboards[R] | bitboards[Q]) != 0;
+
+    return (bitboards[n] | bitboards[b] | bitboards[r] | bitboards[q]) != 0;
+}
+
+static inline int negamax(int alpha, int beta, int depth) {
+    // init PV length, pvLength has a slot for the node past max_ply
+    pvLength[ply] = ply;
+
+    // too deep, bail out before the ply indexed tables overflow
+    if (ply > max_ply - 1)
+        return evaluate();
+
+    if (depth == 0)
+    {
+        return quiescenceSearch(alpha, beta);
+    }
+
+    // poll time and node limits every few thousand nodes
+    if ((nodes & node_check_interval) == 0)
+        checkUp();
 
-static inline int quiescenceSearch(int alpha, int beta) {
-    // evaluate position
-    int evaluation = evaluate();
     nodes++;
 
-    // fail-hard beta cutoff
-    if (evaluation >= beta)
-    {
-        // node (move) fails high
-        return beta;
-    }
+    // null window searches only prove a bound, anything wider is on the PV
+    int pvNode = beta - alpha > 1;
+
+    // hash move of the current position
+    int hashMove = 0;
+
+    // read hash entry, root needs a best move and PV nodes have to fill in
+    // their PV, so only cut elsewhere
+    int score = readHashEntry(alpha, beta, depth, &hashMove);
+    if (ply && !pvNode && score != no_hash_entry)
+    {
+        // position was already searched, return its score
+        return score;
+    }
+
+    // is king in check, legal moves
+    int inCheck = isSquareAttacked((side == white) ? getLSBIndex(bitboards[K]) : getLSBIndex(bitboards[k]), side ^ 1);
+
+    // allow deeper search when in check
+    if (inCheck) depth++;
+
+
+    int legalMoves = 0;
+    int bestMoveSoFar = 0;
+    int hashFlag = hash_flag_alpha;
+
+    // move of the previous iteration's PV, only while still on that line
+    int pvMove = 0;
+    if (followPV)
+    {
+        followPV = 0;
+
+        if (isPseudoLegal(pvTable[0][ply]))
+            pvMove = pvTable[0][ply];
+    }
+
+    // static evaluation for the pruning decisions, PV nodes and nodes in check aren't pruned
+    int staticEval = (inCheck || pvNode) ? -infinity : evaluate();
+
+    // leaf pruning needs a quiet node with both bounds away from mate scores
+    int leafPruning = !pvNode && !inCheck && ply && depth <= leaf_pruning_depth
+                      && abs(alpha) < mate_score && abs(beta) < mate_score;
+
+    // reverse futility: far enough above beta, no move will drop below it
+    if (leafPruning && staticEval - reverse_futility_margin(depth) >= beta)
+        return beta;
+
+    // razoring: far below alpha, only captures could still save the node
+    if (leafPruning && staticEval + razoring_margin(depth) < alpha)
+    {
+        score = quiescenceSearch(alpha, beta);
+
+        if (stopped)
+            return 0;
+
+        if (score <= alpha)
+            return alpha;
+    }
+
+    // quiet moves that don't give check can't lift the score above alpha
+    int futilityPruning = leafPruning && staticEval + futility_margin(depth) <= alpha;
+
+    // null move pruning: if passing still fails high, some real move will too
+    if (!pvNode && !inCheck && ply && depth >= null_move_min_depth && ply >= nullMoveMinPly
+        && !nullMovePlayed[ply - 1] && hasNonPawnMaterial() && staticEval >= beta)
+    {
+        int nullDepth = depth - 1 - (null_move_reduction + depth / 4);
+        if (nullDepth < 0) nullDepth = 0;
+
+        makeNullMove();
+        nullMovePlayed[ply] = 1;
+        ply++;
+
+        prefetchHashEntry(hashKey);
+
+        score = -negamax(-beta, -beta + 1, nullDepth);
+
+        ply--;
+        nullMovePlayed[ply] = 0;
+        unmakeNullMove();
+
+        if (stopped)
+            return 0;
+
+        if (score >= beta)
+        {
+            // shallow fail highs are trusted
+            if (depth < null_move_verify_depth || nullMoveMinPly)
+                return beta;
+
+            // deep ones are verified without null moves for the next plies
+            nullMoveMinPly = ply + 3 * nullDepth / 4;
+            score = negamax(beta - 1, beta, nullDepth);
+            nullMoveMinPly = 0;
+
+            if (stopped)
+                return 0;
+
+            if (score >= beta)
+                return beta;
+        }
+    }
+
+    // create move picker instance
+    move_picker picker[1];
+    initMovePicker(picker, pvMove, hashMove, inCheck ? genEvasions : genAll);
+
+    int move;
+
+    // loop over moves in picking order
+    while ((move = nextMove(picker)))
+    {
+        // base reduction of a late quiet move or losing capture, 0 if it isn't reduced
+        int reduction = 0;
+
+        if (depth >= lmr_min_depth && legalMoves >= lmr_full_depth_moves && !inCheck
+            && (!isNoisy(move) || isBadCapture(move)))
+        {
+            reduction = lmrReductions[depth < max_ply ? depth : max_ply - 1][legalMoves < 63 ? legalMoves + 1 : 63];
+
+            // expected PV and killers are likelier to matter, good history too
+            if (pvNode) reduction--;
+            if (move == killerMoves[0][ply] || move == killerMoves[1][ply]) reduction--;
+            if (!isNoisy(move)) reduction -= historyMoves[move_get_piece(move)][move_get_target(move)] / (max_history / 2);
+        }
+
+        // increment ply
+        ply++;
+
+        makeMove(move);
+        legalMoves++;
+
+        // child position will probe the hash table first
+        prefetchHashEntry(hashKey);
+
+        // checking moves are never reduced or pruned
+        int givesCheck = (reduction > 0 || (futilityPruning && !isNoisy(move)))
+                         && isSquareAttacked(getLSBIndex(bitboards[side == white ? K : k]), side ^ 1);
+
+        // futility pruning, the first move is always searched so the node has a score
+        if (futilityPruning && legalMoves > 1 && !isNoisy(move) && !givesCheck)
+        {
+            ply--;
+            unmakeMove(move);
+            continue;
+        }
+
+        if (givesCheck)
+            reduction = 0;
+
+        // leave at least one ply to the reduced search
+        if (reduction > depth - 2) reduction = depth - 2;
+
+        // keep following the PV only below the PV move
+        if (pvMove)
+            followPV = (move == pvMove);
+
+        // principal variation search, the first move gets the full window
+        if (legalMoves == 1)
+            score = -negamax(-beta, -alpha, depth - 1);
+        else
+        {
+            // later moves only have to prove they don't beat alpha
+            score = -negamax(-alpha - 1, -alpha, depth - 1 - (reduction > 0 ? reduction : 0));
+
+            // reduced move beat alpha, verify it at full depth
+            if (reduction > 0 && score > alpha)
+                score = -negamax(-alpha - 1, -alpha, depth - 1);
+
+            // it really is better, get its exact score
+            if (score > alpha && score < beta)
+                score = -negamax(-beta, -alpha, depth - 1);
+        }
+        ply--;
+
+        // take move back
+        unmakeMove(move);
+
+        // search was aborted, result is meaningless
+        if (stopped)
+            return 0;
+
+        // fail-hard beta cutoff
+        if (score >= beta)
+        {
+            writeHashEntry(beta, depth, hash_flag_beta, move);
+
+            // on quiet moves
+            if (!isNoisy(move))
+                updateQuietHeuristics(move, depth);
+
+            // track move ordering quality
+            betaCutoffs++;
+            if (legalMoves == 1)
+                firstMoveCutoffs++;
+
+            // node(move) fails high
+            return beta;
+        }
+
+        if (score > alpha)
+        {
+            // PV node(move)
+            alpha = score;
+            hashFlag = hash_flag_exact;
+
+            // associate best move with the best score
+            bestMoveSoFar = move;
+
+            // write PV move
+            pvTable[ply][ply] = bestMoveSoFar;
+
+            // copy move from deeper ply into the current ply's line
+            for (int nextPly = ply + 1; nextPly < pvLength[ply + 1]; nextPly++)
+            {
+                pvTable[ply][nextPly] = pvTable[ply + 1][nextPly];
+            }
+
+            // adjust PV length
+            pvLength[ply] = pvLength[ply + 1];
+        }
+    }
+    if (legalMoves == 0)
+    {
+        // king is in check - checkmate
+        if (inCheck)
+        {
+            // return mating score
+            return -mate_value + ply; // + ply to get the mate in least moves possible
+        } else
+        {
+            // king is not in check - stalemate
+            // return stalemate score
+            return 0;
+        }
+    }
+
+    writeHashEntry(alpha, depth, hashFlag, bestMoveSoFar);
+
+    // node (move) fails low
+    return alpha;
+}
+
+// moves to mate of a search score, negative when the side to move gets mated
+int mateDistance(int score) {
+    if (score > mate_score)
+        return (mate_value - score) / 2 + 1;
+
+    return -(mate_value + score) / 2;
+}
+
+// print search score in UCI format
+void printScore(int score) {
+    if (score > mate_score || score < -mate_score)
+        printf("score mate %d", mateDistance(score));
+    else
+        printf("score cp %d", score);
+}
+
+// report an iteration, a bound instead of a PV when the score fell outside the window
+void printIterationInfo(int depth, int score, const char *bound) {
+    long long elapsed = getTimeMs() - startTime;
+    long long searched = totalNodes();
+
+    printf("info depth %d ", depth);
+    printScore(score);
+
+    if (bound)
+        printf(" %s", bound);
+
+    printf(" nodes %lld nps %lld time %lld hashfull %d", searched, searched * 1000 / (elapsed + 1), elapsed,
+           hashFull());
+
+    if (!bound)
+    {
+        printf(" pv");
+
+        // loop over the moves within a PV line
+        for (int count = 0; count < pvLength[0]; count++)
+        {
+            printf(" ");
+            printMove(pvTable[0][count]);
+        }
+    }
+
+    printf("\n");
+}
+
+/*
+ * Aspiration windows
+ *
+ * from aspiration_min_depth on an iteration starts with a window of
+ * aspirationDelta around the previous score, the side that fails is
+ * widened by a growing delta until the score lands inside the window
+ */
+static inline int aspirationSearch(int depth, int previousScore) {
+    int delta = aspirationDelta;
+    int alpha = -infinity;
+    int beta = infinity;
+
+    if (aspirationDelta && depth >= aspiration_min_depth && abs(previousScore) < mate_score)
+    {
+        alpha = previousScore - delta;
+        beta = previousScore + delta;
+    }
+
+    aspirationIterations++;
+
+    while (1)
+    {
+        // start each search on the previous PV
+        followPV = 1;
+
+        int score = negamax(alpha, beta, depth);
+
+        if (stopped)
+            return score;
+
+        if (score <= alpha && alpha > -infinity)
+        {
+            aspirationFailLows++;
+
+            if (threadId == 0)
+                printIterationInfo(depth, score, "upperbound");
+
+            alpha = score - delta > -infinity ? score - delta : -infinity;
+        } else if (score >= beta && beta < infinity)
+        {
+            aspirationFailHighs++;
+
+            if (threadId == 0)
+                printIterationInfo(depth, score, "lowerbound");
+
+            beta = score + delta < infinity ? score + delta : infinity;
+        } else
+        {
+            return score;
+        }
+
+        delta += delta / 2;
+    }
+}
+
+// expected reply when the PV ends at the best move, taken from the hash
+// table after the move and checked, the entry may belong to another position
+int hashPonderMove(int bestMove) {
+    makeMove(bestMove);
+
+    int ponderMove = probeHashMove();
+
+    if (!isLegal(ponderMove))
+        ponderMove = 0;
+
+    unmakeMove(bestMove);
+
+    return ponderMove;
+}
+
+// search position for the best move
+/*
+ * Lazy SMP helper
+ *
+ * searches the root on its own board with its own heuristics until the main
+ * thread stops, the threads only share work through the hash table
+ */
+void *helperSearch(void *argument) {
+    threadId = (int) (size_t) argument;
+
+    loadBoardState(&rootPosition);
+
+    int score = 0;
+
+    // odd helpers run one iteration ahead so the threads spread over depths
+    for (int currentDepth = 1 + threadId % 2; currentDepth <= rootDepth && !stopped; currentDepth++)
+        score = aspirationSearch(currentDepth, score);
+
+    publishNodes();
+
+    return NULL;
+}
+
+void searchPosition(int depth) {
+    // reset search state
+    nodes = 0;
+    stopped = 0;
+    memset(pvTable, 0, sizeof(pvTable));
+    memset(pvLength, 0, sizeof(pvLength));
+    memset(killerMoves, 0, sizeof(killerMoves));
+    betaCutoffs = 0;
+    firstMoveCutoffs = 0;
+    aspirationIterations = 0;
+    aspirationFailLows = 0;
+    aspirationFailHighs = 0;
+
+    // history from previous moves is still useful, but weighs less
+    ageHistory();
+
+    // entries from previous searches become replaceable
+    hashAge = (hashAge + 1) & 63;
+
+    // best move and expected reply of the last completed iteration
+    int completedBestMove = 0;
+    int completedPonderMove = 0;
+
+    // an immediate stop still gets the depth 1 move
+    pollInput = 0;
+
+    // start helpers on a copy of the root position
+    thread_handle helpers[max_threads];
+
+    saveBoardState(&rootPosition);
+    rootDepth = depth;
+
+    for (int thread = 1; thread < threadCount; thread++)
+    {
+        threadNodes[thread].nodes = 0;
+        thread_create(&helpers[thread], helperSearch, (void *) (size_t) thread);
+    }
+
+    // score of the last completed iteration, centre of the next window
+    int score = 0;
+    searchScore = 0;
+
+    // iterative deepening
+    for (int currentDepth = 1; currentDepth <= depth; currentDepth++)
+    {
+        // find best move within a given position
+        score = aspirationSearch(currentDepth, score);
+
+        // iteration was aborted, keep the previous result
+        if (stopped)
+            break;
+
+        completedBestMove = pvTable[0][0];
+        completedPonderMove = pvLength[0] > 1 ? pvTable[0][1] : 0;
+        searchScore = score;
+
+        if (pvLength[0] < currentDepth && abs(score) < mate_score && score != 0)
+            shortPVs++;
+        pollInput = uciInput;
+
+        printIterationInfo(currentDepth, score, NULL);
+
+        // next iteration would most likely not finish in time
+        if (timeSet && getTimeMs() >= softStopTime)
+            break;
+    }
+
+    // a ponder or infinite search answers only after ponderhit or stop
+    while ((pondering || infiniteSearch) && uciInput && !stopped)
+    {
+        readInput();
+#ifdef _WIN32
+        Sleep(1);
+#else
+        usleep(1000);
+#endif
+    }
+
+    // main thread is done, helpers have to stop as well
+    stopped = 1;
+
+    for (int thread = 1; thread < threadCount; thread++)
+        thread_join(helpers[thread]);
+
+    // move ordering quality
+    if (betaCutoffs)
+        printf("info string first move cutoffs %.1f%% of %lld\n",
+               100.0 * firstMoveCutoffs / betaCutoffs, betaCutoffs);
+
+    // window quality, re-searches per iteration with the current AspirationWindow
+    if (aspirationIterations)
+        printf("info string aspiration re-searches %lld in %lld iterations, %lld fail low, %lld fail high\n",
+               aspirationFailLows + aspirationFailHighs, aspirationIterations, aspirationFailLows,
+               aspirationFailHighs);
+
+    // stopped before the first iteration completed, any legal move will do
+    if (!completedBestMove)
+    {
+        moves moveList[1];
+        generateMoves(moveList, genAll);
+
+        if (moveList->count)
+            completedBestMove = moveList->moves[0];
+    }
+
+    if (completedBestMove && !completedPonderMove)
+        completedPonderMove = hashPonderMove(completedBestMove);
+
+    // the GUI always waits for a bestmove, 0000 when there is no legal move
+    printf("bestmove ");
+
+    if (completedBestMove)
+        printMove(completedBestMove);
+    else
+        printf("0000");
+
+    if (completedBestMove && completedPonderMove)
+    {
+        printf(" ponder ");
+        printMove(completedPonderMove);
+    }
+
+    printf("\n");
+}
+
+// FEN debug positions
+#define empty_board "8/8/8/8/8/8/8/8 w - - "
+#define start_position "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1 "
+#define tricky_position "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1 "
+#define killer_position "rnbqkb1r/pp1p1pPp/8/2p1pP2/1P1P4/3P3P/P1P1P3/RNBQKBNR w KQkq e6 0 1"
+#define cmk_position "r2q1rk1/ppp2ppp/2n1bn2/2b1p3/3pP3/3P1NPP/PPP1NPB1/R1BQ1RK1 b - - 0 9 "
+
+/**********************************\
+              Perft suite
+\**********************************/
+
+// deepest "Dn" field read from a suite line
+#define max_suite_depth 15
+
+/*
+ * Perft suite position
+ *
+ * one EPD line, "<fen> ;D1 20 ;D2 400 ;...", with the expected leaf counts
+ * per depth (-1 where the line has none) and what the worker counted
+ */
+typedef struct {
+    char fen[128];
+    long long expected[max_suite_depth + 1];
+    long long found[max_suite_depth + 1];
+    long long nodes;
+    long long time;
+    int failed;
+} suite_position;
+
+suite_position *suitePositions = NULL;
+int suitePositionCount;
+int nextSuitePosition;
+int suiteMaxDepth;
+
+// read one suite line, 0 for blank lines, comments and lines without counts
+int parseSuiteLine(char *line, suite_position *position) {
+    char *field = strchr(line, ';');
+
+    if (line[0] == '#' || field == NULL)
+        return 0;
+
+    int length = (int) (field - line);
+    if (length >= (int) sizeof(position->fen)) length = sizeof(position->fen) - 1;
+
+    while (length > 0 && line[length - 1] == ' ')
+        length--;
+
+    memcpy(position->fen, line, length);
+    position->fen[length] = 0;
+
+    for (int depth = 0; depth <= max_suite_depth; depth++)
+        position->expected[depth] = -1;
 
-    // found a better move
-    if (evaluation > alpha)
+    int counts = 0;
+
+    // ";D<depth> <nodes>" fields
+    for (; field; field = strchr(field + 1, ';'))
     {
-        // PV node (move)
-        alpha = evaluation;
+        int depth;
+        long long expected;
+
+        if (sscanf(field, "; D%d %lld", &depth, &expected) == 2 && depth >= 1 && depth <= max_suite_depth)
+        {
+            position->expected[depth] = expected;
+            counts++;
+        }
     }
 
-    // create move list instance
-    moves moveList[1];
+    return counts > 0;
+}
 
-    // generate moves
-    generateMoves(moveList);
-    sortMoves(moveList); // JFC the speed
+// count positions until none are left, each worker owns its board
+void *suiteWorker(void *argument) {
+    int positionIndex;
 
-    // loop over moves within a movelist
-    for (int count = 0; count < moveList->count; count++)
+    while ((positionIndex = atomic_fetch_increment(&nextSuitePosition)) < suitePositionCount)
     {
-        // preserve board state
-        copy_board();
+        suite_position *position = &suitePositions[positionIndex];
+        long long start = getTimeMs();
 
-        // increment ply
-        ply++;
+        parseFENString(position->fen);
 
-        // make sure to make only legal moves
-        if (makeMove(moveList->moves[count], onlyCaptures) == 0)
+        for (int depth = 1; depth <= suiteMaxDepth; depth++)
         {
-            // decrement ply
-            ply--;
+            if (position->expected[depth] < 0)
+                continue;
 
-            // skip to next move
-            continue;
+            nodes = 0;
+            perftDriver(depth);
+
+            position->found[depth] = nodes;
+            position->nodes += nodes;
+
+            if (nodes != position->expected[depth])
+                position->failed = 1;
         }
 
-        // score current move
-        int score = -quiescenceSearch(-beta, -alpha);
+        position->time = getTimeMs() - start;
+    }
 
-        // decrement ply
-        ply--;
+    return argument;
+}
 
-        // take move back
-        restore_board();
+/*
+ * Perft regression suite
+ *
+ * checks every position of an EPD file against its expected counts up to
+ * maxDepth (0 for all), positions go to the workers whole, so the NPS of a
+ * position is single threaded and the total NPS is over wall clock time
+ */
+void perftSuite(char *fileName, int maxDepth, int threads) {
+    FILE *file = fopen(fileName, "r");
 
-        // fail-hard beta cutoff
-        if (score >= beta)
-        {
-            // node (move) fails high
-            return beta;
-        }
+    if (file == NULL)
+    {
+        printf("info string couldn't open %s\n", fileName);
+        return;
+    }
 
-        // found a better move
-        if (score > alpha)
+    int capacity = 64;
+    char line[1024];
+
+    suitePositions = malloc(capacity * sizeof(suite_position));
+    suitePositionCount = 0;
+
+    while (suitePositions && fgets(line, sizeof(line), file))
+    {
+        if (suitePositionCount == capacity)
         {
-            // PV node (move)
-            alpha = score;
+            capacity *= 2;
+            suitePositions = realloc(suitePositions, capacity * sizeof(suite_position));
+
+            if (suitePositions == NULL)
+                break;
         }
+
+        suite_position *position = &suitePositions[suitePositionCount];
+        memset(position, 0, sizeof(suite_position));
+
+        if (parseSuiteLine(line, position))
+            suitePositionCount++;
     }
 
-    // node (move) fails low
-    return alpha;
+    fclose(file);
+
+    if (suitePositions == NULL)
+    {
+        printf("info string couldn't allocate the perft suite\n");
+        return;
+    }
+
+    if (threads < 1) threads = 1;
+    if (threads > max_threads) threads = max_threads;
+
+    suiteMaxDepth = (maxDepth < 1 || maxDepth > max_suite_depth) ? max_suite_depth : maxDepth;
+    nextSuitePosition = 0;
+
+    printf("\nPerft suite: %d positions, %d threads\n\n", suitePositionCount, threads);
+
+    // entries of an earlier run are still correct, but would flatter the timing
+    if (perftHash)
+        memset(perftHash, 0, perftHashEntries * sizeof(perft_entry));
+
+    long long start = getTimeMs();
+
+    thread_handle workers[max_threads];
+
+    for (int thread = 0; thread < threads; thread++)
+        thread_create(&workers[thread], suiteWorker, NULL);
+
+    for (int thread = 0; thread < threads; thread++)
+        thread_join(workers[thread]);
+
+    long long elapsed = getTimeMs() - start;
+    long long suiteNodes = 0;
+    int failedCount = 0;
+
+    // report in file order, whichever worker counted the position
+    for (int positionIndex = 0; positionIndex < suitePositionCount; positionIndex++)
+    {
+        suite_position *position = &suitePositions[positionIndex];
+
+        suiteNodes += position->nodes;
+        failedCount += position->failed;
+
+        printf("    %4d %s %12lld nodes %7lldms %11lld nps   %s\n", positionIndex + 1,
+               position->failed ? "FAIL" : "ok  ", position->nodes, position->time,
+               position->nodes * 1000 / (position->time + 1), position->fen);
+
+        for (int depth = 1; depth <= suiteMaxDepth; depth++)
+            if (position->expected[depth] >= 0 && position->found[depth] != position->expected[depth])
+                printf("         depth %d: expected %lld, found %lld\n",
+                       depth, position->expected[depth], position->found[depth]);
+    }
+
+    printf("\n    Positions : %d\n", suitePositionCount);
+    printf("    Failed    : %d\n", failedCount);
+    printf("    Nodes     : %lld\n", suiteNodes);
+    printf("    Time      : %lldms\n", elapsed);
+    printf("    NPS       : %lld\n", suiteNodes * 1000 / (elapsed + 1));
+
+    free(suitePositions);
+    suitePositions = NULL;
 }
 
-static inline int negamax(int alpha, int beta, int depth) {
-    if (depth == 0)
+// parse "perftsuite <file> [depth] [threads]", threads default to every core
+void parsePerftSuite(char *command) {
+    char fileName[512];
+    int maxDepth = 0, threads = cpuCount();
+
+    if (sscanf(command, "perftsuite %511s %d %d", fileName, &maxDepth, &threads) < 1)
     {
-        return quiescenceSearch(alpha, beta);
+        printf("info string usage: perftsuite <file> [depth] [threads]\n");
+        return;
     }
 
-    nodes++;
-    // is king in check, legal moves
-    int inCheck = isSquareAttacked((side == white) ? getLSBIndex(bitboards[K]) : getLSBIndex(bitboards[k]), side ^ 1);
+    perftSuite(fileName, maxDepth, threads);
+}
 
-    // allow deeper search when in check
-    if (inCheck) depth++;
+/**********************************\
+              Bench
+\**********************************/
 
+// default bench limits, "bench [depth] [threads] [hash]"
+#define bench_depth 6
+#define bench_hash_size 16
+
+// openings, middlegames and endgames with tactics, promotions and zugzwang
+char *benchPositions[] = {
+    start_position,
+    tricky_position,
+    killer_position,
+    cmk_position,
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 11",
+    "4rrk1/pp1n3p/3q2pQ/2p1pb2/2PP4/2P3N1/P2B2PP/4RRK1 b - - 7 19",
+    "rq3rk1/ppp2ppp/1bnpb3/3N2B1/3NP3/7P/PPPQ1PP1/2KR3R w - - 7 14",
+    "r1bq1r1k/1pp1n1pp/1p1p4/4p2Q/4Pp2/1BNP4/PPP2PPP/3R1RK1 w - - 2 14",
+    "r3r1k1/2p2ppp/p1p1bn2/8/1q2P3/2NPQN2/PPP3PP/R4RK1 b - - 2 15",
+    "r1bbk1nr/pp3p1p/2n5/1N4p1/2Np1B2/8/PPP2PPP/2KR1B1R w kq - 0 13",
+    "r1bq1rk1/ppp1nppp/4n3/3p3Q/3P4/1BP1B3/PP1N2PP/R4RK1 w - - 1 16",
+    "4r1k1/r1q2ppp/ppp2n2/4P3/5Rb1/1N1BQ3/PPP3PP/R5K1 w - - 1 17",
+    "2rqkb1r/ppp2p2/2npb1p1/1N1Nn2p/2P1PP2/8/PP2B1PP/R1BQK2R b KQ - 0 11",
+    "r1bq1r1k/b1p1npp1/p2p3p/1p6/3PP3/1B2NN2/PP3PPP/R2Q1RK1 w - - 1 16",
+    "3r1rk1/p5pp/bpp1pp2/8/q1PP1P2/b3P3/P2NQRPP/1R2B1K1 b - - 6 22",
+    "r1q2rk1/2p1bppp/2Pp4/p6b/Q1PNp3/4B3/PP1R1PPP/2K4R w - - 2 18",
+    "4k2r/1pb2ppp/1p2p3/1R1p4/3P4/2r1PN2/P4PPP/1R4K1 b - - 3 22",
+    "3q2k1/pb3p1p/4pbp1/2r5/PpN2N2/1P2P2P/5PP1/Q2R2K1 b - - 4 26",
+    "r3k2r/3nnpbp/q2pp1p1/p7/Pp1PPPP1/4BNN1/1P5P/R2Q1RK1 w kq - 0 16",
+    "3Qb1k1/1r2ppb1/pN1n2q1/Pp1Pp1Pr/4P2p/4BP2/4B1R1/1R5K b - - 11 40",
+    "4k3/3q1r2/1N2r1b1/3ppN2/2nPP3/1B1R2n1/2R1Q3/3K4 w - - 5 1",
+    "4rrk1/1p1nq3/p7/2p1P1pp/3P2bp/3Q1Bn1/PPPB4/1K2R1NR w - - 40 21",
+    "5rk1/q6p/2p3bR/1pPp1rP1/1P1Pp3/P3B1Q1/1K3P2/R7 w - - 93 90",
+    "1r3k2/4q3/2Pp3b/3Bp3/2Q2p2/1p1P2P1/1P2KP2/3N4 w - - 0 1",
+    "6k1/4pp1p/3p2p1/P1pPb3/R7/1r2P1PP/3B1P2/6K1 w - - 0 1",
+    "6k1/6p1/P6p/r1N5/5p2/7P/1b3PP1/4R1K1 w - - 0 1",
+    "6k1/6p1/6Pp/ppp5/3pn2P/1P3K2/1PP2P2/8 b - - 3 54",
+    "3b4/5kp1/1p1p1p1p/pP1PpP1P/P1P1P3/3KN3/8/8 w - - 0 1",
+    "2K5/p7/7P/5pR1/8/5k2/r7/8 w - - 0 1",
+    "8/6pk/1p6/8/PP3p1p/5P2/4KP1q/3Q4 w - - 0 1",
+    "7k/3p2pp/4q3/8/4Q3/5Kp1/P6b/8 w - - 0 1",
+    "8/2p5/8/2kPKp1p/2p4P/2P5/3P4/8 w - - 0 1",
+    "8/1p3pp1/7p/5P1P/2k3P1/8/2K2P2/8 w - - 0 1",
+    "8/pp2r1k1/2p1p3/3pP2p/1P1P1P1P/P5KR/8/8 w - - 0 1",
+    "8/3p4/p1bk3p/Pp6/1Kp1PpPp/2P2P1P/2P5/5B2 b - - 0 1",
+    "5k2/7R/4P2p/5K2/p1r2P1p/8/8/8 b - - 0 1",
+    "8/3p3B/5p2/5P2/p7/PP5b/k7/6K1 w - - 0 1",
+    "8/8/8/8/5kp1/P7/8/1K1N4 w - - 0 1",
+    "8/8/8/5N2/8/p7/8/2NK3k w - - 0 1",
+    "8/3k4/8/8/8/4B3/4KB2/2B5 w - - 0 1",
+};
 
-    int legalMoves = 0;
-    int bestMoveSoFar;
-    int oldAlpha = alpha;
+#define bench_position_count ((int) (sizeof(benchPositions) / sizeof(benchPositions[0])))
 
-    // create moves list instance
-    moves moveList[1];
+/*
+ * Fixed depth search over the bench positions
+ *
+ * every position starts from an empty hash table and history, so with one
+ * thread the total node count is a signature of the search, any change to
+ * it means the search changed, the NPS is the speed figure between builds
+ */
+void benchmark(int depth, int threads, int megabytes) {
+    int savedThreadCount = threadCount;
+    int savedMegabytes = (int) (hashBuckets * sizeof(tt_bucket) / (1024 * 1024));
 
-    generateMoves(moveList);
-    sortMoves(moveList); // JFC the speed
-    // loop over generated moves
-    for (int count = 0; count < moveList->count; count++)
+    if (depth < 1) depth = 1;
+    if (depth > max_depth) depth = max_depth;
+    if (threads < 1) threads = 1;
+    if (threads > max_threads) threads = max_threads;
+    if (megabytes < 1) megabytes = 1;
+
+    threadCount = threads;
+    initHashTable(megabytes);
+
+    // only the depth limits the search
+    timeSet = 0;
+    nodesLimit = 0;
+    pondering = 0;
+    infiniteSearch = 0;
+
+    // the suite runs to completion, lines typed meanwhile wait in stdin
+    int savedUciInput = uciInput;
+    uciInput = 0;
+
+    long long benchNodes = 0;
+    long long start = getTimeMs();
+
+    shortPVs = 0;
+
+    for (int position = 0; position < bench_position_count; position++)
     {
-        // preserve board state
-        copy_board();
+        printf("\nPosition %d/%d: %s\n", position + 1, bench_position_count, benchPositions[position]);
 
-        // increment ply
-        ply++;
+        parseFENString(benchPositions[position]);
+        clearHashTable();
+        memset(historyMoves, 0, sizeof(historyMoves));
 
-        // make sure to make only legal moves
-        if (makeMove(moveList->moves[count], allMoves) == 0)
-        {
-            ply--;
-            continue;
-        }
-        legalMoves++;
-        // score current move
-        int score = -negamax(-beta, -alpha, depth - 1);
-        ply--;
+        startTime = getTimeMs();
+        searchPosition(depth);
 
-        // take move back
-        restore_board();
+        // helpers published their final counts before they were joined
+        benchNodes += totalNodes();
+    }
 
-        // fail-hard beta cutoff
-        if (score >= beta)
-        {
-            // node(move) fails high
-            return beta;
-        }
+    long long elapsed = getTimeMs() - start;
 
-        if (score > alpha)
-        {
-            // PV node(move)
-            alpha = score;
+    printf("\n    Positions : %d\n", bench_position_count);
+    printf("    Depth     : %d\n", depth);
+    printf("    Threads   : %d\n", threads);
+    printf("    Nodes     : %lld\n", benchNodes);
+    printf("    Short PVs : %lld\n", shortPVs);
+    printf("    Time      : %lldms\n", elapsed);
+    printf("    NPS       : %lld\n", benchNodes * 1000 / (elapsed + 1));
 
-            // if root move
-            if (ply == 0)
-            {
-                // associate best move with the best score
-                bestMoveSoFar = moveList->moves[count];
-            }
-        }
+    threadCount = savedThreadCount;
+    uciInput = savedUciInput;
+    initHashTable(savedMegabytes);
+}
+
+// parse "bench [depth] [threads] [hash]", missing arguments keep the defaults
+void parseBench(char *command) {
+    int depth = bench_depth, threads = 1, megabytes = bench_hash_size;
+
+    sscanf(command, "bench %d %d %d", &depth, &threads, &megabytes);
+
+    benchmark(depth, threads, megabytes);
+}
+
+/*
+ * Mate regression suite
+ *
+ * searches every position of an EPD file, "<fen> ;dm <moves> ;acd <depth>",
+ * to its depth on one thread from an empty hash table and checks the mate
+ * distance of the final score, negative when the side to move gets mated,
+ * and that the PV runs all the way to the mate
+ */
+void mateSuite(char *fileName) {
+    FILE *file = fopen(fileName, "r");
+
+    if (file == NULL)
+    {
+        printf("info string couldn't open %s\n", fileName);
+        return;
     }
-    if (legalMoves == 0)
+
+    int savedThreadCount = threadCount;
+    int savedUciInput = uciInput;
+
+    threadCount = 1;
+    uciInput = 0;
+    timeSet = 0;
+    nodesLimit = 0;
+    pondering = 0;
+    infiniteSearch = 0;
+
+    char line[1024];
+    int positionCount = 0, failedCount = 0;
+    long long start = getTimeMs();
+
+    while (fgets(line, sizeof(line), file))
     {
-        // king is in check - checkmate
-        if (inCheck)
+        char *field = strchr(line, ';');
+        int expected = 0, depth = 0;
+
+        if (line[0] == '#' || field == NULL)
+            continue;
+
+        // ";dm <moves>" and ";acd <depth>" fields
+        for (char *next = field; next; next = strchr(next + 1, ';'))
         {
-            // return mating score
-            return -49000 + ply; // + ply to get the mate in least moves possible
-        } else
+            sscanf(next, "; dm %d", &expected);
+            sscanf(next, "; acd %d", &depth);
+        }
+
+        if (expected == 0 || depth < 1 || depth > max_depth)
+            continue;
+
+        *field = 0;
+        positionCount++;
+
+        printf("\nPosition %d: %s\n", positionCount, line);
+
+        parseFENString(line);
+        clearHashTable();
+        memset(historyMoves, 0, sizeof(historyMoves));
+
+        startTime = getTimeMs();
+        searchPosition(depth);
+
+        int found = abs(searchScore) > mate_score ? mateDistance(searchScore) : 0;
+
+        // the PV has to reach the mate, one ply more when the side to move is mated
+        int mateLength = expected > 0 ? 2 * expected - 1 : -2 * expected;
+
+        if (found != expected)
         {
-            // king is not in check - stalemate
-            // return stalemate score
-            return 0;
+            failedCount++;
+            printf("info string FAIL expected mate %d, found %s%d\n", expected, found ? "mate " : "cp ",
+                   found ? found : searchScore);
+        } else if (pvLength[0] != mateLength)
+        {
+            failedCount++;
+            printf("info string FAIL expected a PV of %d moves, found %d\n", mateLength, pvLength[0]);
         }
     }
-    if (oldAlpha != alpha)
-    {
-        bestMove = bestMoveSoFar;
-    }
-    // node (move) fails low
-    return alpha;
+
+    fclose(file);
+
+    printf("\n    Positions : %d\n", positionCount);
+    printf("    Failed    : %d\n", failedCount);
+    printf("    Time      : %lldms\n", getTimeMs() - start);
+
+    threadCount = savedThreadCount;
+    uciInput = savedUciInput;
 }
 
-// search position for the best move
-void searchPosition(int depth) {
-    // find best move within a given position
-    int score = negamax(-50000, 50000, depth);
+// parse "matesuite <file>"
+void parseMateSuite(char *command) {
+    char fileName[512];
 
-    if (bestMove)
+    if (sscanf(command, "matesuite %511s", fileName) < 1)
     {
-        printf("info score cp %d depth %d nodes %ld\n", score, depth, nodes);
-
-        // best move placeholder
-        printf("bestmove ");
-        printMove(bestMove);
-        printf("\n");
+        printf("info string usage: matesuite <file>\n");
+        return;
     }
-}
 
-// FEN debug positions
-#define empty_board "8/8/8/8/8/8/8/8 w - - "
-#define start_position "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1 "
-#define tricky_position "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1 "
-#define killer_position "rnbqkb1r/pp1p1pPp/8/2p1pP2/1P1P4/3P3P/P1P1P3/RNBQKBNR w KQkq e6 0 1"
-#define cmk_position "r2q1rk1/ppp2ppp/2n1bn2/2b1p3/3pP3/3P1NPP/PPP1NPB1/R1BQ1RK1 b - - 0 9 "
+    mateSuite(fileName);
+}
 // parse UCI position
 void parseUCIPosition(char *command) {
     command += 9; // parse "position keyword"
@@ -2054,7 +4577,7 @@ void parseUCIPosition(char *command) {
                 break;
             }
 
-            makeMove(move, allMoves);
+            makeMove(move);
             while (*currentCharacter && *currentCharacter != ' ')
             {
                 currentCharacter++;
@@ -2065,19 +4588,149 @@ void parseUCIPosition(char *command) {
     printBoard();
 }
 
-// UCI Fixed depth search
+// report compiled in and runtime selected CPU paths
+void printEngineInfo() {
+    printf("info string slider attacks %s, popcount %s, lsb %s\n",
+           slider_backend_names[sliderBackend], popcountName(), lsbName());
+}
+
+// UCI options
+// setoption name Hash value 128
+// setoption name SliderAttacks value pext
+// setoption name Threads value 8
+// setoption name PerftHash value 256
+// setoption name AspirationWindow value 40
+void parseUCISetOption(char *command) {
+    char *currentCharacter = NULL;
+
+    // handle hash table size in MB
+    if ((currentCharacter = strstr(command, "name Hash value")))
+    {
+        int megabytes = atoi(currentCharacter + 16);
+
+        if (megabytes < 1) megabytes = 1;
+
+        initHashTable(megabytes);
+    }
+
+    // handle slider attack indexing, auto picks from CPUID
+    if ((currentCharacter = strstr(command, "name SliderAttacks value")))
+    {
+        currentCharacter += 25;
+
+        if (strncmp(currentCharacter, "magic", 5) == 0)
+            initSliderBackend(sliderMagic);
+        else if (strncmp(currentCharacter, "pext", 4) == 0 && cpuHasFastPext())
+            initSliderBackend(sliderPext);
+        else
+            initSliderBackend(cpuHasFastPext() ? sliderPext : sliderMagic);
+
+        printEngineInfo();
+    }
+
+    // handle aspiration window half width in centipawns, 0 searches every iteration with a full window
+    if ((currentCharacter = strstr(command, "name AspirationWindow value")))
+    {
+        aspirationDelta = atoi(currentCharacter + 28);
+
+        if (aspirationDelta < 0) aspirationDelta = 0;
+    }
+
+    // handle perft cache size in MB, 0 disables it
+    if ((currentCharacter = strstr(command, "name PerftHash value")))
+        initPerftHash(atoi(currentCharacter + 21));
+
+    // handle number of search threads
+    if ((currentCharacter = strstr(command, "name Threads value")))
+    {
+        threadCount = atoi(currentCharacter + 19);
+
+        if (threadCount < 1) threadCount = 1;
+        if (threadCount > max_threads) threadCount = max_threads;
+    }
+}
+
+// UCI search limits
 // go depth 6
-void parseUCCGoDepth(char *command) {
-    int depth = -1;
-    char *currentDepth = NULL;
+// go wtime 60000 btime 60000 winc 1000 binc 1000 movestogo 40
+// go movetime 5000 | go nodes 100000 | go infinite
+// go ponder wtime 60000 btime 60000, the clock starts at ponderhit
+void parseUCIGo(char *command) {
+    int depth = -1, movesToGo = 30, moveTime = -1;
+    int time = -1, increment = 0;
+    char *argument = NULL;
+
+    // reset search limits
+    timeSet = 0;
+    nodesLimit = 0;
+
+    // side to move clock and increment
+    if ((argument = strstr(command, "wtime")) && side == white)
+        time = atoi(argument + 6);
+    if ((argument = strstr(command, "btime")) && side == black)
+        time = atoi(argument + 6);
+    if ((argument = strstr(command, "winc")) && side == white)
+        increment = atoi(argument + 5);
+    if ((argument = strstr(command, "binc")) && side == black)
+        increment = atoi(argument + 5);
+
+    if ((argument = strstr(command, "movestogo")))
+        movesToGo = atoi(argument + 10);
+
+    if ((argument = strstr(command, "movetime")))
+        moveTime = atoi(argument + 9);
+
+    if ((argument = strstr(command, "nodes")))
+        nodesLimit = atoll(argument + 6);
 
     // handle fixed depth search
-    if (currentDepth = strstr(command, "depth"))
+    if ((argument = strstr(command, "depth")))
+        depth = atoi(argument + 6);
+
+    startTime = getTimeMs();
+
+    if (moveTime != -1)
     {
-        depth = atoi(currentDepth + 6);
-    } else
+        // fixed time per move, use all of it
+        timeSet = 1;
+        moveTime -= move_overhead;
+        if (moveTime < 1) moveTime = 1;
+        softStopTime = hardStopTime = startTime + moveTime;
+    } else if (time != -1)
+    {
+        // clock based allocation
+        timeSet = 1;
+        if (movesToGo < 1) movesToGo = 1;
+
+        int available = time - move_overhead;
+        if (available < 1) available = 1;
+
+        // target time for this move
+        int softTime = available / movesToGo + increment * 3 / 4;
+
+        // never spend more than a fraction of the remaining clock
+        int hardTime = softTime * 4;
+        if (hardTime > available / 2) hardTime = available / 2;
+        if (softTime > hardTime) softTime = hardTime;
+
+        softStopTime = startTime + softTime;
+        hardStopTime = startTime + hardTime;
+    }
+
+    // "infinite" or no depth given, search until a limit stops us
+    if (depth == -1)
+        depth = max_depth;
+
+    infiniteSearch = strstr(command, "infinite") != NULL;
+    pondering = strstr(command, "ponder") != NULL;
+
+    // keep the allocation for ponderhit, until then only stop ends the search
+    if (pondering)
     {
-        depth = 6;
+        ponderTimeSet = timeSet;
+        ponderSoftTime = softStopTime - startTime;
+        ponderHardTime = hardStopTime - startTime;
+        timeSet = 0;
     }
 
     // search position
@@ -2096,15 +4749,25 @@ void uciLoop() {
     setbuf(stdout, NULL);
 
     // define user / GUI input buffer
-    char input[2000]; // can be pretty long
+    char input[input_line_size]; // can be pretty long
     // print engine info
     printf("id name Skeibot\n");
     printf("id author Skeibol\n");
+    printf("option name Hash type spin default %d min 1 max 65536\n", default_hash_size);
+    printf("option name SliderAttacks type combo default auto var auto var magic var pext\n");
+    printf("option name Threads type spin default 1 min 1 max %d\n", max_threads);
+    printf("option name PerftHash type spin default 0 min 0 max 65536\n");
+    printf("option name Ponder type check default false\n");
+    printf("option name AspirationWindow type spin default %d min 0 max 1000\n", default_aspiration_delta);
+    printEngineInfo();
     printf("uciok\n");
 
+    // searches poll stdin for stop, ponderhit and quit from here on
+    uciInput = 1;
+
     // main game loop (UCI input loop)
 
-    while (1)
+    while (!quitRequested)
     {
         // reset user/GUI input
         memset(input, 0, sizeof(input));
@@ -2112,11 +4775,11 @@ void uciLoop() {
         // make sure output reaches the GUI
         fflush(stdout);
 
-        // get user / GUI input
-        if (!fgets(input, 2000, stdin))
+        // get user / GUI input, lines queued during a search come first
+        if (!readCommand(input))
         {
-            // continue...
-            continue;
+            // end of input, the GUI is gone
+            break;
         }
         // make sure input is available
         else if (input[0] == '\n')
@@ -2140,12 +4803,44 @@ void uciLoop() {
         else if (strncmp(input, "ucinewgame", 10) == 0) // parse "startpos"
         {
             parseUCIPosition("position startpos");
+            clearHashTable();
+            memset(historyMoves, 0, sizeof(historyMoves));
+        }
+
+        // parse UCI "setoption" command
+        else if (strncmp(input, "setoption", 9) == 0)
+        {
+            parseUCISetOption(input);
+        }
+
+        // parse "bench" command, fixed depth speed and node signature test
+        else if (strncmp(input, "bench", 5) == 0)
+        {
+            parseBench(input);
+        }
+
+        // parse "perftsuite" command, move generator regression test
+        else if (strncmp(input, "perftsuite", 10) == 0)
+        {
+            parsePerftSuite(input);
+        }
+
+        // parse "matesuite" command, mate score regression test
+        else if (strncmp(input, "matesuite", 9) == 0)
+        {
+            parseMateSuite(input);
+        }
+
+        // parse "go perft" command, move generator test
+        else if (strncmp(input, "go perft", 8) == 0)
+        {
+            perftTest(atoi(input + 9));
         }
 
         // parse UCI "newgame" command
         else if (strncmp(input, "go", 2) == 0) // parse "startpos"
         {
-            parseUCCGoDepth(input);
+            parseUCIGo(input);
         }
 
         // parse UCI "quit" command
@@ -2160,22 +4855,76 @@ void uciLoop() {
             // print engine info - UCI specific commands
             printf("id name Skeibot\n");
             printf("id author Skeibol\n");
+            printf("option name Hash type spin default %d min 1 max 65536\n", default_hash_size);
+            printf("option name SliderAttacks type combo default auto var auto var magic var pext\n");
+            printf("option name Threads type spin default 1 min 1 max %d\n", max_threads);
+            printf("option name PerftHash type spin default 0 min 0 max 65536\n");
+            printf("option name Ponder type check default false\n");
+            printf("option name AspirationWindow type spin default %d min 0 max 1000\n", default_aspiration_delta);
+            printEngineInfo();
             printf("uciok\n");
         }
     }
 }
 
+/**********************************\
+              Init all
+\**********************************/
+
+void init_all() {
+#ifndef PREGENERATED_TABLES
+    initLeaperAttacks();
+    initSquaresBetween();
+#endif
+    initSliderBackend(cpuHasFastPext() ? sliderPext : sliderMagic);
+    initRandomKeys();
+    initLmrReductions();
+    initHashTable(default_hash_size);
+}
+
 /********************************************
  *                 MAIN DRIVER              *
  ********************************************/
 
-int main(void) {
+#ifndef NO_ENGINE_MAIN
+int main(int argc, char **argv) {
     init_all();
+
+    // "SkeibotFast bench [depth] [threads] [hash]" runs the bench and exits
+    if (argc > 1 && strcmp(argv[1], "bench") == 0)
+    {
+        char command[64];
+        snprintf(command, sizeof(command), "bench %s %s %s", argc > 2 ? argv[2] : "", argc > 3 ? argv[3] : "",
+                 argc > 4 ? argv[4] : "");
+        parseBench(command);
+        return 0;
+    }
+
+    // "SkeibotFast perftsuite <file> [depth] [threads]" checks the suite and exits
+    if (argc > 2 && strcmp(argv[1], "perftsuite") == 0)
+    {
+        char command[640];
+        snprintf(command, sizeof(command), "perftsuite %s %s %s", argv[2], argc > 3 ? argv[3] : "",
+                 argc > 4 ? argv[4] : "");
+        parsePerftSuite(command);
+        return 0;
+    }
+
+    // "SkeibotFast matesuite <file>" checks the suite and exits
+    if (argc > 2 && strcmp(argv[1], "matesuite") == 0)
+    {
+        char command[640];
+        snprintf(command, sizeof(command), "matesuite %s", argv[2]);
+        parseMateSuite(command);
+        return 0;
+    }
+
     int debug = 0;
     if (debug)
     {
         parseFENString(tricky_position);
         printBoard();
+        startTime = getTimeMs();
         searchPosition(1);
     } else
     {
@@ -2184,3 +4933,4 @@ int main(void) {
 
     return 0;
 }
+#endif
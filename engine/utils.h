@@ -44,141 +44,40 @@ void static inline printBitBoard(U64 bitboard, int initialSquare) {
     printf("BBoard value > %llud\n", bitboard);
 }
 
-// rook magic numbers
-const U64 rook_magic_numbers[64] = {
-    0x8a80104000800020ULL,
-    0x140002000100040ULL,
-    0x2801880a0017001ULL,
-    0x100081001000420ULL,
-    0x200020010080420ULL,
-    0x3001c0002010008ULL,
-    0x8480008002000100ULL,
-    0x2080088004402900ULL,
-    0x800098204000ULL,
-    0x2024401000200040ULL,
-    0x100802000801000ULL,
-    0x120800800801000ULL,
-    0x208808088000400ULL,
-    0x2802200800400ULL,
-    0x2200800100020080ULL,
-    0x801000060821100ULL,
-    0x80044006422000ULL,
-    0x100808020004000ULL,
-    0x12108a0010204200ULL,
-    0x140848010000802ULL,
-    0x481828014002800ULL,
-    0x8094004002004100ULL,
-    0x4010040010010802ULL,
-    0x20008806104ULL,
-    0x100400080208000ULL,
-    0x2040002120081000ULL,
-    0x21200680100081ULL,
-    0x20100080080080ULL,
-    0x2000a00200410ULL,
-    0x20080800400ULL,
-    0x80088400100102ULL,
-    0x80004600042881ULL,
-    0x4040008040800020ULL,
-    0x440003000200801ULL,
-    0x4200011004500ULL,
-    0x188020010100100ULL,
-    0x14800401802800ULL,
-    0x2080040080800200ULL,
-    0x124080204001001ULL,
-    0x200046502000484ULL,
-    0x480400080088020ULL,
-    0x1000422010034000ULL,
-    0x30200100110040ULL,
-    0x100021010009ULL,
-    0x2002080100110004ULL,
-    0x202008004008002ULL,
-    0x20020004010100ULL,
-    0x2048440040820001ULL,
-    0x101002200408200ULL,
-    0x40802000401080ULL,
-    0x4008142004410100ULL,
-    0x2060820c0120200ULL,
-    0x1001004080100ULL,
-    0x20c020080040080ULL,
-    0x2935610830022400ULL,
-    0x44440041009200ULL,
-    0x280001040802101ULL,
-    0x2100190040002085ULL,
-    0x80c0084100102001ULL,
-    0x4024081001000421ULL,
-    0x20030a0244872ULL,
-    0x12001008414402ULL,
-    0x2006104900a0804ULL,
-    0x1004081002402ULL
-};
-
-// bishop magic numbers
-const U64 bishop_magic_numbers[64] = {
-    0x40040844404084ULL,
-    0x2004208a004208ULL,
-    0x10190041080202ULL,
-    0x108060845042010ULL,
-    0x581104180800210ULL,
-    0x2112080446200010ULL,
-    0x1080820820060210ULL,
-    0x3c0808410220200ULL,
-    0x4050404440404ULL,
-    0x21001420088ULL,
-    0x24d0080801082102ULL,
-    0x1020a0a020400ULL,
-    0x40308200402ULL,
-    0x4011002100800ULL,
-    0x401484104104005ULL,
-    0x801010402020200ULL,
-    0x400210c3880100ULL,
-    0x404022024108200ULL,
-    0x810018200204102ULL,
-    0x4002801a02003ULL,
-    0x85040820080400ULL,
-    0x810102c808880400ULL,
-    0xe900410884800ULL,
-    0x8002020480840102ULL,
-    0x220200865090201ULL,
-    0x2010100a02021202ULL,
-    0x152048408022401ULL,
-    0x20080002081110ULL,
-    0x4001001021004000ULL,
-    0x800040400a011002ULL,
-    0xe4004081011002ULL,
-    0x1c004001012080ULL,
-    0x8004200962a00220ULL,
-    0x8422100208500202ULL,
-    0x2000402200300c08ULL,
-    0x8646020080080080ULL,
-    0x80020a0200100808ULL,
-    0x2010004880111000ULL,
-    0x623000a080011400ULL,
-    0x42008c0340209202ULL,
-    0x209188240001000ULL,
-    0x400408a884001800ULL,
-    0x110400a6080400ULL,
-    0x1840060a44020800ULL,
-    0x90080104000041ULL,
-    0x201011000808101ULL,
-    0x1a2208080504f080ULL,
-    0x8012020600211212ULL,
-    0x500861011240000ULL,
-    0x180806108200800ULL,
-    0x4000020e01040044ULL,
-    0x300000261044000aULL,
-    0x802241102020002ULL,
-    0x20906061210001ULL,
-    0x5a84841004010310ULL,
-    0x4010801011c04ULL,
-    0xa010109502200ULL,
-    0x4a02012000ULL,
-    0x500201010098b028ULL,
-    0x8040002811040900ULL,
-    0x28000010020204ULL,
-    0x6000020202d0240ULL,
-    0x8918844842082200ULL,
-    0x4010011029020020ULL
-};
+/********************************************
+ *              BIT OPERATIONS              *
+ *  popcnt / tzcnt / blsr when the compiler *
+ *  targets them, portable loops otherwise  *
+ ********************************************/
+
+#if defined(__GNUC__) || defined(__clang__)
+
+// count bits within a bitboard, popcnt with -mpopcnt / -march=native
+static inline int countBits(U64 bitboard) {
+    return __builtin_popcountll(bitboard);
+}
+
+// get least significant 1st bit index, tzcnt / bsf
+static inline int getLSBIndex(U64 bitboard) {
+    // make sure bitboard is not 0, otherwise return illegal index
+    return bitboard ? __builtin_ctzll(bitboard) : -1;
+}
+
+#elif defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+
+static inline int countBits(U64 bitboard) {
+    return (int) __popcnt64(bitboard);
+}
+
+static inline int getLSBIndex(U64 bitboard) {
+    unsigned long index;
+
+    // make sure bitboard is not 0, otherwise return illegal index
+    return _BitScanForward64(&index, bitboard) ? (int) index : -1;
+}
+
+#else
 
 static inline int countBits(U64 bitboard) {
     // bit counter
@@ -213,5 +112,82 @@ static inline int getLSBIndex(U64 bitboard) {
         return -1;
 }
 
+#endif
+
+// reset least significant 1st bit, blsr
+#define pop_lsb(bitboard) ((bitboard) &= (bitboard) - 1)
+
+// instruction behind countBits, the builtin falls back to a bit trick without -mpopcnt
+static inline const char *popcountName() {
+#if defined(__POPCNT__) || (defined(_MSC_VER) && defined(_M_X64))
+    return "popcnt";
+#else
+    return "software";
+#endif
+}
+
+// instruction behind getLSBIndex, ctz is a single instruction on every 64 bit target
+static inline const char *lsbName() {
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__BMI__)
+    return "tzcnt";
+#elif ((defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)) || (defined(_MSC_VER) && defined(_M_X64))
+    return "bsf";
+#elif defined(__GNUC__) || defined(__clang__)
+    return "ctz";
+#else
+    return "software";
+#endif
+}
+
+/********************************************
+ *              PEXT / CPU FEATURES         *
+ ********************************************/
+
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#include <cpuid.h>
+
+// pext can be emitted without compiling the whole engine for BMI2
+#define PEXT_AVAILABLE
+
+// parallel bits extract, only call when the CPU supports BMI2
+static inline U64 pext(U64 source, U64 mask) {
+    U64 result;
+    __asm__("pextq %2, %1, %0" : "=r" (result) : "r" (source), "rm" (mask));
+    return result;
+}
+
+// BMI2 present and pext implemented in hardware (AMD before Zen 3 microcodes it)
+static inline int cpuHasFastPext() {
+    unsigned int eax, ebx, ecx, edx;
+
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) || !(ebx & (1 << 8)))
+        return 0;
+
+    // vendor string is stored in ebx, edx, ecx
+    __get_cpuid(0, &eax, &ebx, &ecx, &edx);
+    int amd = (ebx == 0x68747541); // "Auth"
+
+    __get_cpuid(1, &eax, &ebx, &ecx, &edx);
+    int family = (eax >> 8) & 0xf;
+    if (family == 0xf)
+        family += (eax >> 20) & 0xff;
+
+    // Zen 3 is family 0x19
+    return !amd || family >= 0x19;
+}
+
+#else
+
+static inline U64 pext(U64 source, U64 mask) {
+    (void) source;
+    (void) mask;
+    return 0ULL;
+}
+
+static inline int cpuHasFastPext() {
+    return 0;
+}
+
+#endif
 
 #endif